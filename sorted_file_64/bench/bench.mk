@@ -0,0 +1,39 @@
+# Benchmark targets. Run from the project root with
+#   make -f bench/bench.mk <target>
+# or add "include bench/bench.mk" to the Makefile.
+
+export_bench:
+	@echo " Compile export_bench ...";
+	gcc -I ./include/ -L ./lib/ -Wl,-rpath,./lib/ ./bench/export_bench.c ./src/*.c -lbf -o ./build/export_bench -O2
+
+index_bench:
+	@echo " Compile index_bench ...";
+	gcc -I ./include/ -L ./lib/ -Wl,-rpath,./lib/ ./bench/index_bench.c ./src/*.c -lbf -o ./build/index_bench -O2
+
+datagen:
+	@echo " Compile datagen ...";
+	gcc -I ./include/ -L ./lib/ -Wl,-rpath,./lib/ ./bench/datagen_main.c ./bench/datagen.c ./src/*.c -lbf -o ./build/datagen -O2
+
+sr_bench:
+	@echo " Compile sr_bench ...";
+	gcc -I ./include/ -L ./lib/ -Wl,-rpath,./lib/ ./bench/sr_bench.c ./bench/datagen.c ./src/*.c -lbf -o ./build/sr_bench -O2
+
+# Queue depth sweep of the I/O engines, e.g.
+#   ./build/io_bench 10000000 /mnt/nvme ./build/io_bench.json
+io_bench:
+	@echo " Compile io_bench ...";
+	gcc -I ./include/ -L ./lib/ -Wl,-rpath,./lib/ ./bench/io_bench.c ./bench/datagen.c ./src/*.c -lbf -o ./build/io_bench -O2
+
+# Runs sr_bench once per size, writing build/bench_<records>.json
+# e.g. make -f bench/bench.mk bench BENCH_RECORDS="100000 10000000" BENCH_DIST=few
+BENCH_RECORDS ?= 10000 100000 1000000
+BENCH_DIST ?= uniform
+BENCH_SEED ?= 12569874
+
+bench: sr_bench datagen
+	@for n in $(BENCH_RECORDS); do \
+		echo " Run sr_bench $$n $(BENCH_DIST) ..."; \
+		./build/sr_bench $$n $(BENCH_DIST) $(BENCH_SEED) ./build/bench_$$n.json || exit 1; \
+	done
+
+.PHONY: export_bench index_bench datagen sr_bench io_bench bench
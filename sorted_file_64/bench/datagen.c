@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bf.h"
+#include "sort_file.h"
+#include "datagen.h"
+
+// Record generator shared by the benchmarks, see datagen.h
+
+const char* distributionNames[] = { "uniform", "sorted", "reverse", "few" };
+
+static const char* names[] = {
+  "Yannis", "Christofos", "Sofia", "Marianna", "Vagelis",
+  "Maria", "Iosif", "Dionisis", "Konstantina", "Theofilos"
+};
+
+static const char* surnames[] = {
+  "Ioannidis", "Svingos", "Karvounari", "Rezkalla", "Nikolopoulos",
+  "Berreta", "Koronis", "Gaitanis", "Oikonomou", "Mailis"
+};
+
+static const char* cities[] = {
+  "Athens", "San Francisco", "Los Angeles", "Amsterdam", "London",
+  "New York", "Tokyo", "Hong Kong", "Munich", "Miami"
+};
+
+int parseDistribution(const char *name) {
+  for (int i = 0; i < 4; i++)
+    if (strcmp(name, distributionNames[i]) == 0)
+      return i;
+  return -1;
+}
+
+// xorshift64*, so that a seed gives the same data on every platform
+static unsigned long long nextRandom(unsigned long long *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ULL;
+}
+
+void generateRecord(Record *record, long i, long count, Distribution distribution,
+                    unsigned long long *state) {
+  memset(record, 0, sizeof(Record));
+
+  if (distribution == DIST_FEW_UNIQUE) {
+    record->id = (int) (nextRandom(state) % 10);
+    strcpy(record->name, names[nextRandom(state) % 10]);
+    strcpy(record->surname, surnames[nextRandom(state) % 10]);
+    strcpy(record->city, cities[nextRandom(state) % 10]);
+    return;
+  }
+
+  // Keys are ids, so they stay in the range of an int
+  int key;
+  if (distribution == DIST_SORTED)
+    key = (int) i;
+  else if (distribution == DIST_REVERSE)
+    key = (int) (count - 1 - i);
+  else
+    key = (int) (nextRandom(state) % 2000000000ULL);
+
+  // Zero padded, so that the string fields order like the numbers
+  // An int takes at most 11 characters, which every field has room for
+  record->id = key;
+  snprintf(record->name, sizeof(record->name), "n%010d", key);
+  snprintf(record->surname, sizeof(record->surname), "s%012d", key);
+  snprintf(record->city, sizeof(record->city), "c%012d", key);
+}
+
+int generateRawFile(const char *path, long count, Distribution distribution,
+                    unsigned long long seed) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  unsigned long long state = seed ? seed : 1;
+  Record record;
+  for (long i = 0; i < count; i++) {
+    generateRecord(&record, i, count, distribution, &state);
+    if (fwrite(&record, sizeof(Record), 1, file) != 1) {
+      perror(path);
+      fclose(file);
+      return -1;
+    }
+  }
+
+  return fclose(file);
+}
@@ -0,0 +1,32 @@
+#ifndef DATAGEN_H
+#define DATAGEN_H
+
+#include "bf.h"
+#include "sort_file.h"
+
+// Record generator shared by the benchmarks
+// Every field of a generated record follows the chosen key distribution,
+// so that sorting on any fieldNo sees the same kind of input
+
+typedef enum Distribution {
+  DIST_UNIFORM,      // Independent random values
+  DIST_SORTED,       // Already in ascending order
+  DIST_REVERSE,      // In descending order
+  DIST_FEW_UNIQUE    // Random values out of a handful of distinct ones
+} Distribution;
+
+extern const char* distributionNames[];
+
+// Returns the Distribution called "name", or -1 for an unknown name
+int parseDistribution(const char *name);
+
+// Fills "record" with the i-th of "count" records
+void generateRecord(Record *record, long i, long count, Distribution distribution,
+                    unsigned long long *state);
+
+// Writes "count" generated records as a raw file, as accepted by SR_BulkLoad
+// Returns 0 on success
+int generateRawFile(const char *path, long count, Distribution distribution,
+                    unsigned long long seed);
+
+#endif // DATAGEN_H
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bf.h"
+#include "sort_file.h"
+#include "datagen.h"
+
+// Generates a sorted-format file of test records
+// Usage: datagen <output.db> [records] [uniform|sorted|reverse|few] [seed]
+
+#define CALL_OR_DIE(call)     \
+  {                           \
+    SR_ErrorCode code = call; \
+    if (code != SR_OK) {      \
+      printf("Error\n");      \
+      exit(code);             \
+    }                         \
+  }
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <output.db> [records] [uniform|sorted|reverse|few] [seed]\n", argv[0]);
+    return 1;
+  }
+
+  const char *output = argv[1];
+  long count = (argc > 2) ? atol(argv[2]) : 2700;
+  int distribution = (argc > 3) ? parseDistribution(argv[3]) : DIST_UNIFORM;
+  unsigned long long seed = (argc > 4) ? strtoull(argv[4], NULL, 10) : 12569874;
+
+  if (distribution < 0) {
+    fprintf(stderr, "Unknown distribution %s\n", argv[3]);
+    return 1;
+  }
+
+  // Records go through a raw scratch file and the bulk loader
+  char rawPath[4096];
+  snprintf(rawPath, sizeof(rawPath), "%s.raw", output);
+  if (generateRawFile(rawPath, count, distribution, seed) != 0)
+    return 1;
+
+  BF_Init(LRU);
+  CALL_OR_DIE(SR_Init());
+  remove(output);
+  CALL_OR_DIE(SR_BulkLoad(output, rawPath, SR_LOAD_RAW));
+  BF_Close();
+
+  remove(rawPath);
+  printf("Generated %ld %s records in %s\n", count, distributionNames[distribution], output);
+}
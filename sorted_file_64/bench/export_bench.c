@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bf.h"
+#include "sort_file.h"
+
+// Throughput benchmark for SR_ExportEntries
+// Usage: export_bench [records] [output path]
+
+#define BENCH_FILE "export_bench.db"
+
+#define CALL_OR_DIE(call)     \
+  {                           \
+    SR_ErrorCode code = call; \
+    if (code != SR_OK) {      \
+      printf("Error\n");      \
+      exit(code);             \
+    }                         \
+  }
+
+const char* names[] = {
+  "Yannis", "Christofos", "Sofia", "Marianna", "Vagelis",
+  "Maria", "Iosif", "Dionisis", "Konstantina", "Theofilos"
+};
+
+const char* surnames[] = {
+  "Ioannidis", "Svingos", "Karvounari", "Rezkalla", "Nikolopoulos",
+  "Berreta", "Koronis", "Gaitanis", "Oikonomou", "Mailis"
+};
+
+const char* cities[] = {
+  "Athens", "San Francisco", "Los Angeles", "Amsterdam", "London",
+  "New York", "Tokyo", "Hong Kong", "Munich", "Miami"
+};
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+  int count = (argc > 1) ? atoi(argv[1]) : 1000000;
+  const char *outputPath = (argc > 2) ? argv[2] : "/dev/null";
+
+  BF_Init(LRU);
+  CALL_OR_DIE(SR_Init());
+
+  remove(BENCH_FILE);
+  int fd;
+  CALL_OR_DIE(SR_CreateFile(BENCH_FILE));
+  CALL_OR_DIE(SR_OpenFile(BENCH_FILE, &fd));
+
+  Record record;
+  memset(&record, 0, sizeof(Record));
+  srand(12569874);
+  for (int id = 0; id < count; ++id) {
+    record.id = id;
+    strcpy(record.name, names[rand() % 10]);
+    strcpy(record.surname, surnames[rand() % 10]);
+    strcpy(record.city, cities[rand() % 10]);
+    CALL_OR_DIE(SR_InsertEntry(fd, record));
+  }
+
+  const char *formatNames[] = { "table", "csv", "raw" };
+  SR_ExportFormat formats[] = { SR_EXPORT_TABLE, SR_EXPORT_CSV, SR_EXPORT_RAW };
+
+  for (int i = 0; i < 3; i++) {
+    int outputFd = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outputFd < 0) {
+      perror(outputPath);
+      exit(1);
+    }
+
+    double start = now();
+    CALL_OR_DIE(SR_ExportEntries(fd, outputFd, formats[i]));
+    double elapsed = now() - start;
+
+    off_t bytes = lseek(outputFd, 0, SEEK_END);
+    close(outputFd);
+
+    printf("%-6s %d records in %.3lf s: %.0lf records/s", formatNames[i], count, elapsed, count / elapsed);
+    if (bytes > 0)
+      printf(", %.1lf MB/s", bytes / elapsed / 1e6);
+    printf("\n");
+  }
+
+  CALL_OR_DIE(SR_CloseFile(fd));
+  BF_Close();
+  remove(BENCH_FILE);
+}
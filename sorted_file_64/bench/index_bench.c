@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bf.h"
+#include "sort_file.h"
+
+// Compares building a B+tree index with SR_CreateIndex
+// against keeping a full sorted copy made by SR_SortedFile
+// Usage: index_bench [records] [fieldNo] [bufferSize]
+
+#define BASE_FILE   "index_bench.db"
+#define SORTED_FILE "index_bench_sorted.db"
+#define INDEX_FILE  "index_bench_index.db"
+
+#define CALL_OR_DIE(call)     \
+  {                           \
+    SR_ErrorCode code = call; \
+    if (code != SR_OK) {      \
+      printf("Error\n");      \
+      exit(code);             \
+    }                         \
+  }
+
+const char* names[] = {
+  "Yannis", "Christofos", "Sofia", "Marianna", "Vagelis",
+  "Maria", "Iosif", "Dionisis", "Konstantina", "Theofilos"
+};
+
+const char* surnames[] = {
+  "Ioannidis", "Svingos", "Karvounari", "Rezkalla", "Nikolopoulos",
+  "Berreta", "Koronis", "Gaitanis", "Oikonomou", "Mailis"
+};
+
+const char* cities[] = {
+  "Athens", "San Francisco", "Los Angeles", "Amsterdam", "London",
+  "New York", "Tokyo", "Hong Kong", "Munich", "Miami"
+};
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void countRecord(const Record *record, void *context) {
+  (void) record;
+  (*(long *) context)++;
+}
+
+static int blocksOf(const char *filename) {
+  int fd, blocks;
+  BF_OpenFile(filename, &fd);
+  BF_GetBlockCounter(fd, &blocks);
+  BF_CloseFile(fd);
+  return blocks;
+}
+
+int main(int argc, char **argv) {
+  int count = (argc > 1) ? atoi(argv[1]) : 100000;
+  int fieldNo = (argc > 2) ? atoi(argv[2]) : 0;
+  int bufferSize = (argc > 3) ? atoi(argv[3]) : 32;
+
+  BF_Init(LRU);
+  CALL_OR_DIE(SR_Init());
+
+  remove(BASE_FILE);
+  remove(SORTED_FILE);
+  remove(INDEX_FILE);
+
+  int fd;
+  CALL_OR_DIE(SR_CreateFile(BASE_FILE));
+  CALL_OR_DIE(SR_OpenFile(BASE_FILE, &fd));
+
+  Record record;
+  memset(&record, 0, sizeof(Record));
+  srand(12569874);
+  for (int i = 0; i < count; ++i) {
+    record.id = rand();
+    strcpy(record.name, names[rand() % 10]);
+    strcpy(record.surname, surnames[rand() % 10]);
+    strcpy(record.city, cities[rand() % 10]);
+    CALL_OR_DIE(SR_InsertEntry(fd, record));
+  }
+  CALL_OR_DIE(SR_CloseFile(fd));
+
+  double start = now();
+  CALL_OR_DIE(SR_SortedFile(BASE_FILE, SORTED_FILE, fieldNo, bufferSize));
+  double sortTime = now() - start;
+
+  start = now();
+  CALL_OR_DIE(SR_CreateIndex(BASE_FILE, INDEX_FILE, fieldNo, bufferSize));
+  double indexTime = now() - start;
+
+  printf("records        %d\n", count);
+  printf("sorted copy    %.3lf s, %d blocks\n", sortTime, blocksOf(SORTED_FILE));
+  printf("index          %.3lf s, %d blocks\n", indexTime, blocksOf(INDEX_FILE));
+
+  // Point lookups on keys taken from the base file
+  int indexDesc;
+  CALL_OR_DIE(SR_OpenFile(BASE_FILE, &fd));
+  CALL_OR_DIE(SR_OpenIndex(INDEX_FILE, &indexDesc));
+
+  // Only the id is close to unique, the other fields match a tenth of the file per key
+  int lookups = (fieldNo == 0) ? 10000 : 10;
+  long found = 0;
+  srand(12569874);
+  start = now();
+  for (int i = 0; i < lookups; ++i) {
+    record.id = rand();
+    strcpy(record.name, names[rand() % 10]);
+    strcpy(record.surname, surnames[rand() % 10]);
+    strcpy(record.city, cities[rand() % 10]);
+    CALL_OR_DIE(SR_IndexSearch(indexDesc, fd, &record, countRecord, &found));
+  }
+  double lookupTime = now() - start;
+  printf("lookups        %d in %.3lf s, %ld records found\n", lookups, lookupTime, found);
+
+  CALL_OR_DIE(SR_CloseIndex(indexDesc));
+  CALL_OR_DIE(SR_CloseFile(fd));
+  BF_Close();
+
+  remove(BASE_FILE);
+  remove(SORTED_FILE);
+  remove(INDEX_FILE);
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bf.h"
+#include "sort_file.h"
+#include "datagen.h"
+
+// Queue depth benchmark for the I/O engines of SR_BulkLoad and SR_ExportEntries
+// Usage: io_bench [records] [directory] [output.json]
+//
+// The files are placed in "directory", e.g. a mount of the device under test.
+// Before each load the source is dropped from the page cache, and each export
+// ends with fdatasync, so both cases include the device round trips
+
+#define BENCH_FILE "io_bench.db"
+#define RAW_FILE "io_bench.raw"
+#define EXPORT_FILE "io_bench.out"
+
+#define CALL_OR_DIE(call)     \
+  {                           \
+    SR_ErrorCode code = call; \
+    if (code != SR_OK) {      \
+      printf("Error\n");      \
+      exit(code);             \
+    }                         \
+  }
+
+static FILE *json;
+static int results = 0;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Writes back and evicts the pages of "path", so that it is read from the device again
+static void dropCache(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    exit(1);
+  }
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+static void report(const char *name, const char *engine, int depth, long records,
+                   long long bytes, double wall, double cpu) {
+  fprintf(json, "%s\n    {\"case\": \"%s\", \"engine\": \"%s\", \"queue_depth\": %d"
+                ", \"records\": %ld, \"bytes\": %lld, \"wall_s\": %.6f, \"cpu_s\": %.6f"
+                ", \"mb_per_s\": %.1f}",
+          results++ ? "," : "", name, engine, depth, records, bytes, wall, cpu,
+          wall > 0 ? bytes / wall / 1e6 : 0.0);
+  fflush(json);
+
+  fprintf(stderr, "%-8s %-6s depth %2d %10.3f s %10.1f MB/s\n",
+          name, engine, depth, wall, wall > 0 ? bytes / wall / 1e6 : 0.0);
+}
+
+static void benchLoad(const char *engine, int depth, long count, long long bytes) {
+  remove(BENCH_FILE);
+  dropCache(RAW_FILE);
+
+  double cpu = (double) clock() / CLOCKS_PER_SEC;
+  double wall = now();
+  CALL_OR_DIE(SR_BulkLoad(BENCH_FILE, RAW_FILE, SR_LOAD_RAW));
+  wall = now() - wall;
+  cpu = (double) clock() / CLOCKS_PER_SEC - cpu;
+
+  report("load", engine, depth, count, bytes, wall, cpu);
+}
+
+static void benchExport(const char *engine, int depth, long count, long long bytes) {
+  int fd;
+  CALL_OR_DIE(SR_OpenFile(BENCH_FILE, &fd));
+
+  int outputFd = open(EXPORT_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (outputFd < 0) {
+    perror(EXPORT_FILE);
+    exit(1);
+  }
+
+  double cpu = (double) clock() / CLOCKS_PER_SEC;
+  double wall = now();
+  CALL_OR_DIE(SR_ExportEntries(fd, outputFd, SR_EXPORT_RAW));
+  fdatasync(outputFd);
+  wall = now() - wall;
+  cpu = (double) clock() / CLOCKS_PER_SEC - cpu;
+
+  close(outputFd);
+  CALL_OR_DIE(SR_CloseFile(fd));
+  remove(EXPORT_FILE);
+
+  report("export", engine, depth, count, bytes, wall, cpu);
+}
+
+int main(int argc, char **argv) {
+  long count = (argc > 1) ? atol(argv[1]) : 1000000;
+  const char *directory = (argc > 2) ? argv[2] : ".";
+  const char *jsonPath = (argc > 3) ? argv[3] : NULL;
+
+  json = stdout;
+  if (jsonPath != NULL && (json = fopen(jsonPath, "w")) == NULL) {
+    perror(jsonPath);
+    return 1;
+  }
+  if (chdir(directory) != 0) {
+    perror(directory);
+    return 1;
+  }
+
+  BF_Init(LRU);
+  CALL_OR_DIE(SR_Init());
+
+  if (generateRawFile(RAW_FILE, count, DIST_UNIFORM, 12569874) != 0)
+    return 1;
+  long long bytes = (long long) count * sizeof(Record);
+
+  bool uring = SR_SetIOEngine(SR_IO_URING, 1) == SR_OK;
+  CALL_OR_DIE(SR_SetIOEngine(SR_IO_SYNC, 1));
+
+  fprintf(json, "{\n  \"records\": %ld, \"record_size\": %d, \"io_uring\": %s,\n  \"results\": [",
+          count, (int) sizeof(Record), uring ? "true" : "false");
+
+  benchLoad("sync", 1, count, bytes);
+  benchExport("sync", 1, count, bytes);
+
+  for (int depth = 1; uring && depth <= SR_MAX_IO_DEPTH; depth *= 2) {
+    CALL_OR_DIE(SR_SetIOEngine(SR_IO_URING, depth));
+    benchLoad("uring", depth, count, bytes);
+    benchExport("uring", depth, count, bytes);
+  }
+  if (!uring)
+    fprintf(stderr, "io_uring is not available, only the sync engine was measured\n");
+
+  fprintf(json, "\n  ]\n}\n");
+  if (json != stdout)
+    fclose(json);
+
+  CALL_OR_DIE(SR_SetIOEngine(SR_IO_SYNC, 1));
+  BF_Close();
+  remove(BENCH_FILE);
+  remove(RAW_FILE);
+}
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bf.h"
+#include "sort_file.h"
+#include "datagen.h"
+
+// Benchmark suite for the sort and block layers, with JSON output
+// Usage: sr_bench [records] [uniform|sorted|reverse|few] [seed] [output.json]
+//
+// Blocks read and written are taken from the rchar/wchar counters of
+// /proc/self/io, so they count every byte the process moved through
+// read(2)/write(2), whether or not it reached the disk
+
+#define BENCH_FILE "sr_bench.db"
+#define INSERT_FILE "sr_bench_insert.db"
+#define SORTED_FILE "sr_bench_sorted.db"
+
+// Passes of the BF_GetBlock hit loop over the cached blocks
+#define HIT_ROUNDS 4096
+
+#define CALL_OR_DIE(call)     \
+  {                           \
+    SR_ErrorCode code = call; \
+    if (code != SR_OK) {      \
+      printf("Error\n");      \
+      exit(code);             \
+    }                         \
+  }
+
+#define BF_CALL_OR_DIE(call)  \
+  {                           \
+    BF_ErrorCode code = call; \
+    if (code != BF_OK) {      \
+      BF_PrintError(code);    \
+      exit(code);             \
+    }                         \
+  }
+
+typedef struct measure {
+  double wall;
+  double cpu;
+  long long readBytes;
+  long long writeBytes;
+} measure;
+
+static FILE *json;
+static int results = 0;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Reads the rchar/wchar counters, or leaves zeros where /proc is missing
+static void readIO(long long *readBytes, long long *writeBytes) {
+  *readBytes = 0;
+  *writeBytes = 0;
+
+  FILE *file = fopen("/proc/self/io", "r");
+  if (file == NULL)
+    return;
+
+  char key[64];
+  long long value;
+  while (fscanf(file, "%63[^:]: %lld\n", key, &value) == 2) {
+    if (strcmp(key, "rchar") == 0)
+      *readBytes = value;
+    else if (strcmp(key, "wchar") == 0)
+      *writeBytes = value;
+  }
+  fclose(file);
+}
+
+static void startMeasure(measure *m) {
+  readIO(&m->readBytes, &m->writeBytes);
+  m->cpu = (double) clock() / CLOCKS_PER_SEC;
+  m->wall = now();
+}
+
+static void stopMeasure(measure *m) {
+  m->wall = now() - m->wall;
+  m->cpu = (double) clock() / CLOCKS_PER_SEC - m->cpu;
+
+  long long readBytes, writeBytes;
+  readIO(&readBytes, &writeBytes);
+  m->readBytes = readBytes - m->readBytes;
+  m->writeBytes = writeBytes - m->writeBytes;
+}
+
+// Appends one result object; "params" holds extra members, e.g. "\"fieldNo\": 0"
+static void report(const char *name, const char *params, long records, const measure *m) {
+  fprintf(json, "%s\n    {\"case\": \"%s\"", results++ ? "," : "", name);
+  if (params[0] != '\0')
+    fprintf(json, ", %s", params);
+  fprintf(json, ", \"records\": %ld, \"wall_s\": %.6f, \"cpu_s\": %.6f"
+                ", \"blocks_read\": %lld, \"blocks_written\": %lld, \"records_per_s\": %.1f}",
+          records, m->wall, m->cpu,
+          m->readBytes / BF_BLOCK_SIZE, m->writeBytes / BF_BLOCK_SIZE,
+          m->wall > 0 ? records / m->wall : 0.0);
+  fflush(json);
+
+  fprintf(stderr, "%-14s %-52.52s %10.3f s %12.0f records/s\n",
+          name, params, m->wall, m->wall > 0 ? records / m->wall : 0.0);
+}
+
+// Writes the counters of SR_GetStats and SR_GetSortStats as extra members
+static void appendStats(char *params, size_t size) {
+  SR_Stats stats;
+  SR_SortStats sort;
+  SR_GetStats(-1, &stats);
+  SR_GetSortStats(&sort);
+
+  int length = snprintf(params, size,
+                        ", \"pins\": %lld, \"allocations\": %lld, \"unpins\": %lld, \"dirtied\": %lld"
+                        ", \"peak_pinned\": %d, \"pin_errors\": %lld, \"phases\": [",
+                        stats.pins, stats.allocations, stats.unpins, stats.dirtied,
+                        stats.peakPinned, stats.errors[BF_FULL_MEMORY_ERROR]);
+
+  // The ratio is that of the bytes of the records to the bytes of the blocks they took
+  for (int i = 0; i < sort.phases && length < (int) size; i++)
+    length += snprintf(params + length, size - length,
+                       "%s{\"runs\": %d, \"merges\": %d, \"bytes\": %lld, \"blocks\": %lld"
+                       ", \"ratio\": %.3f, \"seconds\": %.6f}",
+                       i ? ", " : "", sort.runs[i], sort.merges[i], sort.bytes[i], sort.blocks[i],
+                       sort.blocks[i] ? (double) sort.bytes[i] / (sort.blocks[i] * BF_BLOCK_SIZE) : 0.0,
+                       sort.seconds[i]);
+
+  if (length < (int) size)
+    snprintf(params + length, size - length, "]");
+}
+
+static void switchAlgorithm(ReplacementAlgorithm algorithm) {
+  BF_CALL_OR_DIE(BF_Close());
+  BF_CALL_OR_DIE(BF_Init(algorithm));
+  CALL_OR_DIE(SR_Init());
+}
+
+static void benchInsert(long count, Distribution distribution, unsigned long long seed) {
+  remove(INSERT_FILE);
+  int fd;
+  CALL_OR_DIE(SR_CreateFile(INSERT_FILE));
+  CALL_OR_DIE(SR_OpenFile(INSERT_FILE, &fd));
+
+  unsigned long long state = seed;
+  Record record;
+  measure m;
+  startMeasure(&m);
+  for (long i = 0; i < count; i++) {
+    generateRecord(&record, i, count, distribution, &state);
+    CALL_OR_DIE(SR_InsertEntry(fd, record));
+  }
+  CALL_OR_DIE(SR_CloseFile(fd));
+  stopMeasure(&m);
+
+  report("insert", "", count, &m);
+  remove(INSERT_FILE);
+}
+
+static void benchSort(long count) {
+  const ReplacementAlgorithm algorithms[] = { LRU, MRU };
+  const char *algorithmNames[] = { "LRU", "MRU" };
+  const int bufferSizes[] = { 3, 16, BF_BUFFER_SIZE };
+
+  for (int a = 0; a < 2; a++) {
+    switchAlgorithm(algorithms[a]);
+
+    for (int b = 0; b < 3; b++) {
+      for (int fieldNo = 0; fieldNo < 4; fieldNo++) {
+        for (int compressed = 0; compressed < 2; compressed++) {
+          remove(SORTED_FILE);
+          CALL_OR_DIE(SR_SetTempCompression(compressed));
+
+          measure m;
+          SR_ResetStats();
+          startMeasure(&m);
+          CALL_OR_DIE(SR_SortedFile(BENCH_FILE, SORTED_FILE, fieldNo, bufferSizes[b]));
+          stopMeasure(&m);
+
+          char params[256 + SR_MAX_PHASES * 144];
+          int length = snprintf(params, sizeof(params),
+                                "\"algorithm\": \"%s\", \"bufferSize\": %d, \"fieldNo\": %d"
+                                ", \"compressed\": %s",
+                                algorithmNames[a], bufferSizes[b], fieldNo, compressed ? "true" : "false");
+          appendStats(params + length, sizeof(params) - length);
+          report("sort", params, count, &m);
+        }
+      }
+    }
+    CALL_OR_DIE(SR_SetTempCompression(false));
+  }
+
+  remove(SORTED_FILE);
+  switchAlgorithm(LRU);
+}
+
+static void benchPrint(long count) {
+  int fd;
+  CALL_OR_DIE(SR_OpenFile(BENCH_FILE, &fd));
+
+  // SR_PrintAllEntries writes to stdout, which is pointed at /dev/null
+  fflush(stdout);
+  int savedStdout = dup(STDOUT_FILENO);
+  int devNull = open("/dev/null", O_WRONLY);
+  dup2(devNull, STDOUT_FILENO);
+  close(devNull);
+
+  measure m;
+  startMeasure(&m);
+  CALL_OR_DIE(SR_PrintAllEntries(fd));
+  fflush(stdout);
+  stopMeasure(&m);
+
+  dup2(savedStdout, STDOUT_FILENO);
+  close(savedStdout);
+
+  CALL_OR_DIE(SR_CloseFile(fd));
+  report("print", "", count, &m);
+}
+
+// Pins and unpins blocks with BF_GetBlock: "hit" cycles over as many blocks as
+// fit in the buffer, "miss" scans the whole file so no block is still cached
+static void benchGetBlock(void) {
+  int fd, blocks;
+  BF_CALL_OR_DIE(BF_OpenFile(BENCH_FILE, &fd));
+  BF_CALL_OR_DIE(BF_GetBlockCounter(fd, &blocks));
+
+  BF_Block *block;
+  BF_Block_Init(&block);
+
+  int cached = blocks < BF_BUFFER_SIZE - 1 ? blocks : BF_BUFFER_SIZE - 1;
+  long hits = (long) cached * HIT_ROUNDS;
+  measure m;
+  startMeasure(&m);
+  for (long i = 0; i < hits; i++) {
+    BF_CALL_OR_DIE(BF_GetBlock(fd, (int) (i % cached), block));
+    BF_CALL_OR_DIE(BF_UnpinBlock(block));
+  }
+  stopMeasure(&m);
+  report("getblock_hit", "\"unit\": \"blocks\"", hits, &m);
+
+  if (blocks > BF_BUFFER_SIZE) {
+    long misses = blocks;
+    startMeasure(&m);
+    for (long i = 0; i < misses; i++) {
+      BF_CALL_OR_DIE(BF_GetBlock(fd, (int) i, block));
+      BF_CALL_OR_DIE(BF_UnpinBlock(block));
+    }
+    stopMeasure(&m);
+    report("getblock_miss", "\"unit\": \"blocks\"", misses, &m);
+  }
+
+  BF_Block_Destroy(&block);
+  BF_CALL_OR_DIE(BF_CloseFile(fd));
+}
+
+int main(int argc, char **argv) {
+  long count = (argc > 1) ? atol(argv[1]) : 100000;
+  int distribution = (argc > 2) ? parseDistribution(argv[2]) : DIST_UNIFORM;
+  unsigned long long seed = (argc > 3) ? strtoull(argv[3], NULL, 10) : 12569874;
+  const char *jsonPath = (argc > 4) ? argv[4] : NULL;
+
+  if (distribution < 0) {
+    fprintf(stderr, "Unknown distribution %s\n", argv[2]);
+    return 1;
+  }
+  if (seed == 0)
+    seed = 1;
+
+  json = stdout;
+  if (jsonPath != NULL && (json = fopen(jsonPath, "w")) == NULL) {
+    perror(jsonPath);
+    return 1;
+  }
+
+  BF_Init(LRU);
+  CALL_OR_DIE(SR_Init());
+
+  // The file every other case reads is built with the bulk loader
+  char rawPath[64];
+  snprintf(rawPath, sizeof(rawPath), "%s.raw", BENCH_FILE);
+  if (generateRawFile(rawPath, count, distribution, seed) != 0)
+    return 1;
+  remove(BENCH_FILE);
+  CALL_OR_DIE(SR_BulkLoad(BENCH_FILE, rawPath, SR_LOAD_RAW));
+  remove(rawPath);
+
+  fprintf(json, "{\n  \"records\": %ld, \"distribution\": \"%s\", \"seed\": %llu,"
+                " \"block_size\": %d, \"buffer_size\": %d,\n  \"results\": [",
+          count, distributionNames[distribution], seed, BF_BLOCK_SIZE, BF_BUFFER_SIZE);
+
+  benchInsert(count, distribution, seed);
+  benchSort(count);
+  benchPrint(count);
+  benchGetBlock();
+
+  fprintf(json, "\n  ]\n}\n");
+  if (json != stdout)
+    fclose(json);
+
+  BF_Close();
+  remove(BENCH_FILE);
+}
@@ -1,6 +1,8 @@
 #ifndef SORT_FILE_H
 #define SORT_FILE_H
 
+#include "bf.h"
+
 typedef enum SR_ErrorCode
 {
   SR_OK,
@@ -17,6 +19,95 @@ typedef struct Record
 	char city[20];
 } Record;
 
+// Output formats supported by SR_ExportEntries
+typedef enum SR_ExportFormat
+{
+  SR_EXPORT_TABLE,  // The bordered table printed by SR_PrintAllEntries
+  SR_EXPORT_CSV,    // "id,name,surname,city" header followed by one line per record
+  SR_EXPORT_RAW     // The Record structs back to back, as stored in the blocks
+} SR_ExportFormat;
+
+// Source formats accepted by SR_BulkLoad
+typedef enum SR_LoadFormat
+{
+  SR_LOAD_CSV,      // "id,name,surname,city" lines, as written by SR_EXPORT_CSV
+  SR_LOAD_RAW       // Record structs back to back, as written by SR_EXPORT_RAW
+} SR_LoadFormat;
+
+// How SR_BulkLoad reads its source and the export functions write their output
+typedef enum SR_IOEngine
+{
+  SR_IO_SYNC,       // read(2)/write(2) on one buffer at a time (default)
+  SR_IO_URING       // io_uring, with up to the queue depth of buffers in flight
+} SR_IOEngine;
+
+// The deepest queue SR_SetIOEngine accepts
+#define SR_MAX_IO_DEPTH	(32)
+
+// Aggregates computed per group by SR_SortedAggregate, all of them over the id
+typedef enum SR_Aggregate
+{
+  SR_AGG_COUNT,     // Number of records in the group
+  SR_AGG_SUM,       // Sum of the ids of the group
+  SR_AGG_MIN,       // Smallest id of the group
+  SR_AGG_MAX        // Largest id of the group
+} SR_Aggregate;
+
+// What SR_SortedDistinct considers a duplicate
+typedef enum SR_DistinctMode
+{
+  SR_DISTINCT_KEY,      // Any record with the same sort field as one already kept
+  SR_DISTINCT_RECORD    // A record equal to one already kept in every field
+} SR_DistinctMode;
+
+// How a sort schedules its merges once Phase Zero has written the runs
+typedef enum SR_MergePlan
+{
+  SR_PLAN_BALANCED, // Passes merging runs in order, bufferSize - 1 at a time
+  SR_PLAN_OPTIMAL   // Shortest runs first, the fewest blocks read and written (default)
+} SR_MergePlan;
+
+// Block activity counters of the sort_file layer, see SR_GetStats
+// Only what passes through this layer is counted: the BF layer does not
+// expose its hits, misses, evictions or disk I/O
+typedef struct SR_Stats
+{
+  long long pins;           // Blocks requested with BF_GetBlock
+  long long allocations;    // Blocks appended with BF_AllocateBlock
+  long long unpins;         // Blocks unpinned
+  long long dirtied;        // Blocks marked dirty, written back once evicted
+  int pinned;               // Frames pinned right now
+  int peakPinned;           // Most frames pinned at once
+  long long errors[BF_ERROR + 1];   // Failed pins and allocations, per BF_ErrorCode
+} SR_Stats;
+
+// Phase Zero plus every merge pass of a sort, see SR_GetSortStats
+#define SR_MAX_PHASES	(32)
+
+// What the last sort did, phase by phase: phase 0 is Phase Zero, phase
+// i > 0 the merges writing runs made of i levels of merges, which for
+// SR_PLAN_BALANCED is the i-th pass; the last phase writes the output
+typedef struct SR_SortStats
+{
+  int phases;                       // Phases run, so phases - 1 merge passes
+  int runs[SR_MAX_PHASES];          // Runs written by each phase
+  int merges[SR_MAX_PHASES];        // Merges done by each phase, 0 for Phase Zero
+  long long bytes[SR_MAX_PHASES];   // Bytes of records written by each phase
+  long long blocks[SR_MAX_PHASES];  // Blocks written by each phase, fewer than the
+                                    // bytes take when the runs are compressed
+  double seconds[SR_MAX_PHASES];    // Wall time of each phase
+} SR_SortStats;
+
+// One sort of SR_RunSortJobs: input_filename sorted on fieldNo into output_filename
+typedef struct SR_SortJob
+{
+  const char *input_filename;
+  const char *output_filename;
+  int fieldNo;
+  SR_ErrorCode result;      // Set once the job has run
+  SR_SortStats stats;       // Phases of the job, as SR_GetSortStats would report them
+} SR_SortJob;
+
 // Boolean type defined as a means of improving readability
 typedef enum { false, true } bool;
 
@@ -43,6 +134,41 @@ typedef enum { false, true } bool;
 // a file is of the "sorted" format
 #define SORTED 		('s')
 
+// Each "sorted" file stores at block[META]->data[SORTED_ON] the number
+// of the field its records are ordered by plus one, zero meaning no known order
+// It is set by SR_SortedFile and cleared by SR_InsertEntry
+#define SORTED_ON	 (1)
+
+// Once SR_InsertEntry appends to a file sorted on some field, the file stores
+// at block[META]->data[PREFIX_ON] that field plus one, and where its sorted
+// prefix ends: the first record appended went to slot PREFIX_SLOT (an int)
+// of block PREFIX_BLOCK (a long long). Only meaningful while SORTED_ON is
+// zero, see SR_Resort
+#define PREFIX_ON	 (2)
+#define PREFIX_BLOCK (sizeof(long long))
+#define PREFIX_SLOT	 (2 * sizeof(long long))
+
+// Each "sorted" file stores at block[META]->data[SEGMENT_BLOCKS] the number
+// of blocks of each of its segment files as an int, zero meaning
+// SR_MAX_SEGMENT_BLOCKS (see SR_SetSegmentBlocks)
+#define SEGMENT_BLOCKS	 (BF_BLOCK_SIZE - sizeof(int))
+
+// The most blocks a single BF file can hold: BF computes byte offsets
+// in an int, so larger files are split into segment files
+#define SR_MAX_SEGMENT_BLOCKS	 (0x7fffffff / BF_BLOCK_SIZE)
+
+// Identifier used in indicating
+// a file is a B+tree index (see SR_CreateIndex)
+#define INDEXED		('i')
+
+// Callback through which the search functions hand out the matching records
+// The record points into a pinned block and is only valid during the call
+typedef void (*SR_RecordCallback)(const Record *record, void *context);
+
+// Callback through which SR_MergeJoin hands out every pair of joined records
+// Both records are only valid during the call
+typedef void (*SR_JoinCallback)(const Record *left, const Record *right, void *context);
+
 /*
  * Η συνάρτηση SR_Init χρησιμοποιείται για την αρχικοποίηση του sort_file.
  * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
@@ -60,6 +186,19 @@ SR_ErrorCode SR_CreateFile(
 	const char *fileName		/* όνομα αρχείου */
 	);
 
+/*
+ * Η συνάρτηση SR_SetSegmentBlocks ορίζει πόσα block έχει κάθε τμήμα των
+ * αρχείων που δημιουργεί από εδώ και πέρα η SR_CreateFile, μαζί με τα αρχεία
+ * εξόδου και τα προσωρινά, με 0 για SR_MAX_SEGMENT_BLOCKS (προεπιλογή). Ένα
+ * μεγαλύτερο αρχείο συνεχίζει στα "<fileName>.1", "<fileName>.2" κ.ο.κ.,
+ * όπου όλες οι συναρτήσεις φτάνουν μέσω του αναγνωριστικού του αρχείου, με
+ * αριθμούς block 64 bit. Τα τμήματα διαγράφονται ή μετονομάζονται μαζί με το
+ * αρχείο. Επιστρέφει SR_OK, ή SR_ERROR για μέγεθος εκτός ορίων.
+ */
+SR_ErrorCode SR_SetSegmentBlocks(
+  int blocks                /* block ανά τμήμα, ή 0 */
+  );
+
 /*
  * Η συνάρτηση SR_OpenFile ανοίγει το αρχείο με όνομα filename και διαβάζει
  * από το πρώτο μπλοκ την πληροφορία που αφορά το αρχείο ταξινόμησης. Επιστρέφει
@@ -124,6 +263,60 @@ SR_ErrorCode SR_SortedFile(
   int bufferSize            /* Το πλήθος των block μνήμης που έχετε διαθέσιμα */
   );
 
+/*
+ * Η συνάρτηση SR_SortedDistinct λειτουργεί όπως η SR_SortedFile, αλλά
+ * παραλείπει τα διπλότυπα: με SR_DISTINCT_KEY κρατά μία εγγραφή για κάθε τιμή
+ * του πεδίου fieldNo (όποια από τις ίσες, αφού η ταξινόμηση δεν είναι
+ * ευσταθής), ενώ με SR_DISTINCT_RECORD ένα αντίγραφο κάθε διαφορετικής
+ * εγγραφής. Τα διπλότυπα πετιούνται μόλις συναντηθούν, στη Φάση 0 και σε
+ * κάθε συγχώνευση.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_SortedDistinct(
+  const char* input_filename,   /* όνομα αρχείου προς ταξινόμηση */
+  const char* output_filename,  /* όνομα του τελικού ταξινομημένου αρχείου */
+  int fieldNo,                  /* αύξων αριθμός πεδίου προς ταξινόμηση */
+  int bufferSize,           /* Το πλήθος των block μνήμης που έχετε διαθέσιμα */
+  SR_DistinctMode distinct      /* τι θεωρείται διπλότυπο */
+  );
+
+/*
+ * Η συνάρτηση SR_SortedTopK γράφει στο output_filename τις k μικρότερες
+ * εγγραφές του input_filename ως προς το πεδίο fieldNo, ταξινομημένες, όπως
+ * τις πρώτες k εγγραφές της SR_SortedFile. Αν οι k εγγραφές χωράνε σε
+ * bufferSize - 1 block, η είσοδος διαβάζεται μία φορά κρατώντας τες σε σωρό.
+ * Αλλιώς κάθε run κόβεται στις k εγγραφές, και όσες είναι μεγαλύτερες από την
+ * τελευταία ενός γεμάτου run πετιούνται πριν ταξινομηθούν.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_SortedTopK(
+  const char* input_filename,   /* όνομα αρχείου προς ταξινόμηση */
+  const char* output_filename,  /* όνομα του τελικού ταξινομημένου αρχείου */
+  int fieldNo,                  /* αύξων αριθμός πεδίου προς ταξινόμηση */
+  int k,                        /* πλήθος εγγραφών που κρατούνται */
+  int bufferSize            /* Το πλήθος των block μνήμης που έχετε διαθέσιμα */
+  );
+
+/*
+ * Η συνάρτηση SR_Resort ταξινομεί επί τόπου το ανοιχτό αρχείο fileDesc ως
+ * προς το πεδίο fieldNo με bufferSize block μνήμης. Αν το αρχείο ταξινομήθηκε
+ * με την SR_SortedFile ως προς το fieldNo και μετά προστέθηκαν εγγραφές με την
+ * SR_InsertEntry, ταξινομείται μόνο η ουρά, σε προσωρινό αρχείο, και
+ * συγχωνεύεται στο αρχείο από το τέλος προς την αρχή. Αλλιώς ταξινομείται
+ * ολόκληρο. Σφάλμα πριν ταξινομηθεί η ουρά αφήνει το αρχείο ως είχε, ενώ
+ * σφάλμα κατά τη συγχώνευση το αφήνει χωρίς γνωστή ταξινόμηση και χωρίς τις
+ * εγγραφές της ουράς που δεν είχαν συγχωνευθεί.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_Resort(
+  int fileDesc,             /* αναγνωριστικός αριθμός ανοίγματος αρχείου */
+  int fieldNo,              /* αύξων αριθμός πεδίου προς ταξινόμηση */
+  int bufferSize            /* Το πλήθος των block μνήμης που έχετε διαθέσιμα */
+  );
+
 /*
  * Η συνάρτηση SR_PrintAllEntries χρησιμοποιείται για την εκτύπωση όλων των
  * εγγραφών που υπάρχουν στο αρχείο ταξινόμησης. Το fileDesc είναι ο αναγνωριστικός
@@ -135,4 +328,275 @@ SR_ErrorCode SR_PrintAllEntries(
   int fileDesc		/* αναγνωριστικός αριθμός ανοίγματος αρχείου */
   );
 
+/*
+ * Η συνάρτηση SR_ExportEntries γράφει όλες τις εγγραφές του αρχείου
+ * ταξινόμησης fileDesc στον περιγραφέα outputFd, στη μορφή format. Οι
+ * εγγραφές μαζεύονται σε ένα μεγάλο buffer, που δίνεται στη μηχανή I/O (βλ.
+ * SR_SetIOEngine) μόνο όταν γεμίσει. Το outputFd το ανοίγει και το κλείνει
+ * αυτός που καλεί τη συνάρτηση.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_ExportEntries(
+  int fileDesc,             /* αναγνωριστικός αριθμός ανοίγματος αρχείου */
+  int outputFd,             /* περιγραφέας του αρχείου εξόδου */
+  SR_ExportFormat format    /* πίνακας, CSV ή δυαδική μορφή */
+  );
+
+/*
+ * Η συνάρτηση SR_BulkLoad δημιουργεί το αρχείο ταξινόμησης filename και το
+ * γεμίζει με τις εγγραφές του αρχείου source, που είναι στη μορφή format. Το
+ * CSV διαβάζεται σε κομμάτια παράλληλα και μπορεί να ξεκινά με γραμμή
+ * επικεφαλίδας. Τα block γεμίζουν απευθείας, με ένα pin ανά block αντί για
+ * ένα ανά εγγραφή όπως με την SR_InsertEntry.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_BulkLoad(
+  const char *filename,     /* όνομα αρχείου που θα δημιουργηθεί */
+  const char *source,       /* διαδρομή του αρχείου εισόδου */
+  SR_LoadFormat format      /* μορφή του αρχείου εισόδου */
+  );
+
+/*
+ * Η συνάρτηση SR_SortedBulkLoad λειτουργεί όπως η SR_BulkLoad, αλλά το αρχείο
+ * που προκύπτει είναι ταξινομημένο ως προς το fieldNo, όπως με την
+ * SR_SortedFile με bufferSize block μνήμης. Στο μεταξύ οι εγγραφές
+ * φορτώνονται στο προσωρινό αρχείο "<filename>.load", που διαγράφεται μετά.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_SortedBulkLoad(
+  const char *filename,     /* όνομα αρχείου που θα δημιουργηθεί */
+  const char *source,       /* διαδρομή του αρχείου εισόδου */
+  SR_LoadFormat format,     /* μορφή του αρχείου εισόδου */
+  int fieldNo,              /* αύξων αριθμός πεδίου προς ταξινόμηση */
+  int bufferSize            /* Το πλήθος των block μνήμης που έχετε διαθέσιμα */
+  );
+
+/*
+ * Η συνάρτηση SR_SetIOEngine επιλέγει πώς οι επόμενες φορτώσεις διαβάζουν την
+ * πηγή τους και οι επόμενες εξαγωγές γράφουν την έξοδό τους. Με SR_IO_SYNC
+ * κάθε buffer διαβάζεται ή γράφεται με μία κλήση συστήματος τη φορά, ενώ με
+ * SR_IO_URING έως queueDepth buffers είναι σε εξέλιξη μαζί. Τα block των
+ * αρχείων ταξινόμησης περνούν από το επίπεδο BF και δεν επηρεάζονται. Αν ο
+ * πυρήνας δεν έχει io_uring, επιστρέφεται SR_ERROR και η μηχανή μένει ως
+ * είχε. Δεν πρέπει να καλείται ενώ τρέχουν φορτώσεις ή εξαγωγές. Σε
+ * περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK.
+ */
+SR_ErrorCode SR_SetIOEngine(
+  SR_IOEngine engine,       /* μηχανή των επόμενων φορτώσεων και εξαγωγών */
+  int queueDepth            /* buffers σε εξέλιξη, από 1 έως SR_MAX_IO_DEPTH */
+  );
+
+/*
+ * Η συνάρτηση SR_CreateIndex δημιουργεί το ευρετήριο B+tree index_filename
+ * στο πεδίο fieldNo του αρχείου ταξινόμησης input_filename. Οι καταχωρήσεις
+ * (κλειδί, block, θέση) ταξινομούνται με την SR_SortedFile με bufferSize
+ * block μνήμης, γεμίζουν τα φύλλα και από πάνω χτίζονται τα εσωτερικά
+ * επίπεδα. Εγγραφές που εισάγονται αργότερα δεν φαίνονται στο ευρετήριο. Το
+ * input_filename δεν πρέπει να είναι ανοιχτό, και τα προσωρινά αρχεία
+ * "<index_filename>.keys" και "<index_filename>.sorted" διαγράφονται μετά.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_CreateIndex(
+  const char *input_filename,   /* όνομα αρχείου που ευρετηριάζεται */
+  const char *index_filename,   /* όνομα του αρχείου ευρετηρίου */
+  int fieldNo,                  /* αύξων αριθμός πεδίου του κλειδιού */
+  int bufferSize            /* Το πλήθος των block μνήμης που έχετε διαθέσιμα */
+  );
+
+/*
+ * Η συνάρτηση SR_OpenIndex ανοίγει το αρχείο ευρετηρίου index_filename και
+ * επιστρέφει στην indexDesc τον αναγνωριστικό αριθμό ανοίγματός του. Αν το
+ * αρχείο δεν είναι ευρετήριο, αυτό θεωρείται περίπτωση σφάλματος.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_OpenIndex(
+  const char *index_filename,   /* όνομα του αρχείου ευρετηρίου */
+  int *indexDesc                /* αναγνωριστικός αριθμός ανοίγματος ευρετηρίου */
+  );
+
+/*
+ * Η συνάρτηση SR_CloseIndex κλείνει το ευρετήριο indexDesc.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_CloseIndex(
+  int indexDesc                 /* αναγνωριστικός αριθμός ανοίγματος ευρετηρίου */
+  );
+
+/*
+ * Η συνάρτηση SR_IndexRangeScan καλεί την callback, με τη σειρά του κλειδιού,
+ * για κάθε εγγραφή του αρχείου fileDesc της οποίας το πεδίο του ευρετηρίου
+ * είναι από το ίδιο πεδίο της low έως το ίδιο πεδίο της high. Αν η low ή η
+ * high είναι NULL, το διάστημα μένει ανοιχτό από εκείνη την πλευρά.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_IndexRangeScan(
+  int indexDesc,                /* αναγνωριστικός αριθμός ανοίγματος ευρετηρίου */
+  int fileDesc,                 /* το αρχείο πάνω στο οποίο χτίστηκε το ευρετήριο */
+  const Record *low,            /* κάτω όριο του διαστήματος, ή NULL */
+  const Record *high,           /* άνω όριο του διαστήματος, ή NULL */
+  SR_RecordCallback callback,   /* καλείται για κάθε εγγραφή που ταιριάζει */
+  void *context                 /* δίνεται στην callback */
+  );
+
+/*
+ * Η συνάρτηση SR_IndexSearch καλεί την callback για κάθε εγγραφή του αρχείου
+ * fileDesc της οποίας το πεδίο του ευρετηρίου είναι ίσο με το ίδιο πεδίο της
+ * key.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_IndexSearch(
+  int indexDesc,                /* αναγνωριστικός αριθμός ανοίγματος ευρετηρίου */
+  int fileDesc,                 /* το αρχείο πάνω στο οποίο χτίστηκε το ευρετήριο */
+  const Record *key,            /* εγγραφή με την τιμή που αναζητείται */
+  SR_RecordCallback callback,   /* καλείται για κάθε εγγραφή που ταιριάζει */
+  void *context                 /* δίνεται στην callback */
+  );
+
+/*
+ * Η συνάρτηση SR_MergeJoin καλεί την callback για κάθε ζεύγος εγγραφών των
+ * ανοιχτών αρχείων fdA και fdB που είναι ίσες στο πεδίο fieldNo. Κάθε αρχείο
+ * διαβάζεται μία φορά, ένα block τη φορά. Οι εγγραφές του fdB με το ίδιο
+ * κλειδί κρατιούνται στη μνήμη όσο χωράνε στα bufferSize block, αλλιώς
+ * ξαναδιαβάζονται από το αρχείο. Αρχείο που δεν είναι ταξινομημένο ως προς το
+ * fieldNo ταξινομείται πρώτα σε προσωρινό αρχείο.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_MergeJoin(
+  int fdA,                      /* αριστερή είσοδος */
+  int fdB,                      /* δεξιά είσοδος */
+  int fieldNo,                  /* αύξων αριθμός πεδίου του join */
+  int bufferSize,           /* Το πλήθος των block μνήμης που έχετε διαθέσιμα */
+  SR_JoinCallback callback,     /* καλείται για κάθε ζεύγος */
+  void *context                 /* δίνεται στην callback */
+  );
+
+/*
+ * Η συνάρτηση SR_SortedAggregate ομαδοποιεί τις εγγραφές του input_filename
+ * ως προς το πεδίο fieldNo και γράφει στο αρχείο κειμένου output_filename,
+ * μετά από μία γραμμή επικεφαλίδας, μία γραμμή CSV "key,value" ανά ομάδα με
+ * τη σειρά του κλειδιού, όπου value η τιμή agg της ομάδας. Χρησιμοποιεί την
+ * εξωτερική ταξινόμηση της SR_SortedFile με bufferSize block μνήμης, όπου οι
+ * εγγραφές με το ίδιο κλειδί ενώνονται μόλις συναντηθούν, στη Φάση 0 και σε
+ * κάθε συγχώνευση.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_SortedAggregate(
+  const char* input_filename,   /* όνομα αρχείου προς ομαδοποίηση */
+  int fieldNo,                  /* αύξων αριθμός πεδίου ομαδοποίησης */
+  int bufferSize,           /* Το πλήθος των block μνήμης που έχετε διαθέσιμα */
+  SR_Aggregate agg,             /* τιμή που υπολογίζεται ανά ομάδα */
+  const char* output_filename   /* αρχείο κειμένου εξόδου */
+  );
+
+/*
+ * Η συνάρτηση SR_SetMergePlan επιλέγει πώς οι επόμενες ταξινομήσεις
+ * συγχωνεύουν τα runs τους. Με SR_PLAN_BALANCED γίνονται περάσματα, που
+ * συγχωνεύουν τα runs του προηγούμενου ανά bufferSize - 1. Με SR_PLAN_OPTIMAL
+ * (προεπιλογή) συγχωνεύονται πάντα τα μικρότερα runs, με μια πρώτη μικρότερη
+ * συγχώνευση ώστε οι υπόλοιπες να παίρνουν όλες bufferSize - 1 runs, κάτι που
+ * διαβάζει και γράφει τα λιγότερα block. Δεν πρέπει να καλείται ενώ τρέχουν
+ * ταξινομήσεις. Επιστρέφει SR_OK, ή SR_ERROR για άγνωστο plan.
+ */
+SR_ErrorCode SR_SetMergePlan(
+  SR_MergePlan plan         /* σχέδιο συγχωνεύσεων των επόμενων ταξινομήσεων */
+  );
+
+/*
+ * Η συνάρτηση SR_PrintMergePlan τυπώνει τις συγχωνεύσεις που θα έκανε η
+ * SR_SortedFile στο input_filename με bufferSize block και το σχέδιο plan: τα
+ * runs της Φάσης 0, μία γραμμή ανά συγχώνευση με τα μήκη των runs της, και τα
+ * block που διαβάζονται και γράφονται συνολικά.
+ * Σε περίπτωση που εκτελεστεί επιτυχώς, επιστρέφεται SR_OK, ενώ σε
+ * διαφορετική περίπτωση κάποιος κωδικός λάθους.
+ */
+SR_ErrorCode SR_PrintMergePlan(
+  const char* input_filename,   /* όνομα αρχείου προς ταξινόμηση */
+  int bufferSize,           /* Το πλήθος των block μνήμης που έχετε διαθέσιμα */
+  SR_MergePlan plan             /* σχέδιο συγχωνεύσεων προς εκτύπωση */
+  );
+
+/*
+ * Η συνάρτηση SR_SetTempDirectory ορίζει τον κατάλογο όπου οι ταξινομήσεις
+ * δημιουργούν τα προσωρινά τους αρχεία, με NULL ή "" για τον τρέχοντα
+ * κατάλογο (προεπιλογή). Τα προσωρινά αρχεία ονομάζονται "sort_<pid>_<n>.db",
+ * μοναδικά ανά ταξινόμηση. Δεν πρέπει να καλείται ενώ τρέχουν ταξινομήσεις.
+ * Επιστρέφει SR_OK, ή SR_ERROR αν δεν μπορούν να γραφτούν αρχεία στον
+ * κατάλογο.
+ */
+SR_ErrorCode SR_SetTempDirectory(
+  const char *path          /* κατάλογος των προσωρινών αρχείων */
+  );
+
+/*
+ * Η συνάρτηση SR_SetTempCompression επιλέγει αν οι επόμενες ταξινομήσεις
+ * γράφουν τα runs στο προσωρινό αρχείο συμπιεσμένα. Κάθε εγγραφή γράφεται σε
+ * σχέση με την προηγούμενη του block της: το id ως διαφορά μεταβλητού μήκους
+ * και κάθε συμβολοσειρά ως το κοινό πρόθεμα με την προηγούμενη και τα bytes
+ * που ακολουθούν. Το αρχείο εξόδου δεν συμπιέζεται ποτέ. Είναι
+ * απενεργοποιημένη από προεπιλογή και δεν πρέπει να καλείται ενώ τρέχουν
+ * ταξινομήσεις. Επιστρέφει SR_OK.
+ */
+SR_ErrorCode SR_SetTempCompression(
+  bool enabled              /* συμπίεση των runs των επόμενων ταξινομήσεων */
+  );
+
+/*
+ * Η συνάρτηση SR_RunSortJobs εκτελεί τις jobCount ταξινομήσεις του jobs, έως
+ * threads ταυτόχρονα, καθεμία όπως η SR_SortedFile. Μοιράζονται bufferSize
+ * block μνήμης: κάθε κομμάτι της Φάσης 0 και κάθε συγχώνευση παίρνει ίσο
+ * μερίδιο και το επιστρέφει όταν τελειώσει. Κάθε ταξινόμηση θέλει 4 block,
+ * οπότε έως bufferSize / 4 τρέχουν μαζί. Πρέπει να διαβάζουν και να γράφουν
+ * διαφορετικά αρχεία, και καμία άλλη κλήση του sort_file δεν πρέπει να κάνει
+ * pin block στο μεταξύ. Το αποτέλεσμα και οι φάσεις κάθε ταξινόμησης
+ * γράφονται σε αυτή. Επιστρέφει SR_OK αν πέτυχαν όλες, αλλιώς τον κωδικό
+ * λάθους της πρώτης που απέτυχε.
+ */
+SR_ErrorCode SR_RunSortJobs(
+  SR_SortJob *jobs,         /* οι ταξινομήσεις */
+  int jobCount,             /* πλήθος ταξινομήσεων */
+  int threads,              /* μέγιστο πλήθος ταυτόχρονων ταξινομήσεων */
+  int bufferSize            /* Το πλήθος των block μνήμης που έχετε διαθέσιμα */
+  );
+
+/*
+ * Η συνάρτηση SR_GetStats αντιγράφει στο stats τη δραστηριότητα των block από
+ * την τελευταία κλήση της SR_ResetStats (ή της SR_Init): του ανοιχτού αρχείου
+ * fileDesc, ή όλων των αρχείων αν το fileDesc είναι -1. Ανά αρχείο μετρώνται
+ * μόνο τα pin, οι δεσμεύσεις και τα σφάλματα. Hits, misses, evictions,
+ * αναγνώσεις και εγγραφές στο δίσκο και αναμονές για pin δεν αναφέρονται,
+ * αφού το επίπεδο BF δεν τα δίνει. Επιστρέφει SR_OK, ή SR_ERROR αν το
+ * fileDesc είναι εκτός ορίων.
+ */
+SR_ErrorCode SR_GetStats(
+  int fileDesc,             /* αναγνωριστικός αριθμός ανοίγματος αρχείου, ή -1 */
+  SR_Stats *stats           /* συμπληρώνεται με τους μετρητές */
+  );
+
+/*
+ * Η συνάρτηση SR_GetSortStats αντιγράφει στο stats τις φάσεις της τελευταίας
+ * ταξινόμησης του νήματος που την καλεί, της SR_SortedFile ή κάποιας
+ * συνάρτησης που βασίζεται σε αυτή. Οι ταξινομήσεις της SR_RunSortJobs
+ * γράφουν τις δικές τους στο stats της ταξινόμησης. Επιστρέφει SR_OK.
+ */
+SR_ErrorCode SR_GetSortStats(
+  SR_SortStats *stats       /* συμπληρώνεται με τις φάσεις της ταξινόμησης */
+  );
+
+/*
+ * Η συνάρτηση SR_ResetStats μηδενίζει τους μετρητές της SR_GetStats και, για
+ * το νήμα που την καλεί, της SR_GetSortStats. Τα frames που είναι ακόμα
+ * pinned μένουν μετρημένα στο pinned.
+ */
+void SR_ResetStats();
+
 #endif // SORT_FILE_H
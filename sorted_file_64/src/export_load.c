@@ -0,0 +1,797 @@
+#include "sort_file_internal.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+// Utility Function:
+// Hands everything held in the buffer to the I/O engine and moves on to the
+// next buffer of the queue, once it is no longer being written
+static SR_ErrorCode flushExport(exportBuffer *buffer)
+{
+	if (buffer->used == 0)
+		return SR_OK;
+
+	ioRequest *request = &buffer->queue.requests[buffer->current];
+	request->length = buffer->used;
+	request->done = 0;
+	request->offset = buffer->offset;
+	if (buffer->offset >= 0)
+		buffer->offset += buffer->used;
+	SR_CALL_OR_EXIT( submitRequest(&buffer->queue, buffer->current) );
+
+	buffer->current = (buffer->current + 1) % buffer->queue.depth;
+	while (buffer->queue.requests[buffer->current].busy)
+		SR_CALL_OR_EXIT( waitRequest(&buffer->queue) );
+	buffer->data = buffer->queue.requests[buffer->current].data;
+	buffer->used = 0;
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Sets up the buffers of an export to the file descriptor outputFd
+// Several can only be in flight at once when each is written at its own
+// offset, so outputs that cannot seek or append get one at a time
+SR_ErrorCode openExport(exportBuffer *buffer, int outputFd)
+{
+	long long offset = -1;
+	int flags = fcntl(outputFd, F_GETFL);
+	if (ioEngine == SR_IO_URING && ioDepth > 1 && flags >= 0 && !(flags & O_APPEND))
+		offset = lseek(outputFd, 0, SEEK_CUR);
+
+	SR_CALL_OR_EXIT( openQueue(&buffer->queue, outputFd, true, (offset < 0) ? 1 : ioDepth, EXPORT_BUFFER_SIZE) );
+	buffer->current = 0;
+	buffer->offset = offset;
+	buffer->used = 0;
+	buffer->data = buffer->queue.requests[0].data;
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Writes what is left in the buffer unless "flush" is false, waits for every
+// write and frees the buffers
+// The file position is left past the output, as write(2) would have left it
+SR_ErrorCode closeExport(exportBuffer *buffer, bool flush)
+{
+	SR_ErrorCode rv = flush ? flushExport(buffer) : SR_OK;
+
+	SR_ErrorCode closeCode = closeQueue(&buffer->queue);
+	if (rv == SR_OK)
+		rv = closeCode;
+
+	if (rv == SR_OK && buffer->offset >= 0 && lseek(buffer->queue.fd, buffer->offset, SEEK_SET) < 0)
+	{
+		perror("SR export");
+		rv = SR_ERROR;
+	}
+
+	return rv;
+}
+
+// Utility Function:
+// Makes sure there are at least "length" free bytes in the buffer
+SR_ErrorCode reserveExport(exportBuffer *buffer, size_t length)
+{
+	if (buffer->used + length > EXPORT_BUFFER_SIZE)
+		SR_CALL_OR_EXIT( flushExport(buffer) );
+
+	return SR_OK;
+}
+
+static void appendBytes(exportBuffer *buffer, const char *bytes, size_t length)
+{
+	memcpy(&buffer->data[buffer->used], bytes, length);
+	buffer->used += length;
+}
+
+static void appendPadding(exportBuffer *buffer, int length)
+{
+	if (length > 0)
+	{
+		memset(&buffer->data[buffer->used], ' ', length);
+		buffer->used += length;
+	}
+}
+
+// Utility Function:
+// Appends the decimal representation of "val" to the buffer
+// Returns the number of characters written
+int appendNumber(exportBuffer *buffer, long long val)
+{
+	char digits[21];
+	int length = 0;
+
+	// Work with the unsigned magnitude so that the minimum value does not overflow
+	unsigned long long magnitude = (val < 0) ? 0ull - (unsigned long long) val : (unsigned long long) val;
+	do {
+		digits[length++] = '0' + (magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude);
+
+	if (val < 0)
+		digits[length++] = '-';
+
+	for (int i = length - 1; i >= 0; i--)
+		buffer->data[buffer->used++] = digits[i];
+
+	return length;
+}
+
+// Utility Function:
+// Appends a string field as a table column padded to "width"
+static void appendTableField(exportBuffer *buffer, const char *field, size_t size, int width)
+{
+	size_t length = strnlen(field, size);
+
+	buffer->data[buffer->used++] = '|';
+	appendBytes(buffer, field, length);
+	appendPadding(buffer, width - (int) length);
+}
+
+// Utility Function:
+// Appends a string field as a CSV value
+// Values containing a separator, a quote or a newline are quoted
+void appendCSVField(exportBuffer *buffer, const char *field, size_t size)
+{
+	size_t length = strnlen(field, size);
+
+	bool quote = false;
+	for (size_t i = 0; i < length && !quote; i++)
+		quote = (field[i] == ',' || field[i] == '"' || field[i] == '\n' || field[i] == '\r');
+
+	if (!quote)
+	{
+		appendBytes(buffer, field, length);
+		return;
+	}
+
+	buffer->data[buffer->used++] = '"';
+	for (size_t i = 0; i < length; i++)
+	{
+		if (field[i] == '"')
+			buffer->data[buffer->used++] = '"';
+		buffer->data[buffer->used++] = field[i];
+	}
+	buffer->data[buffer->used++] = '"';
+}
+
+static void appendTableRecord(exportBuffer *buffer, const Record *record)
+{
+	buffer->data[buffer->used++] = '|';
+	int length = appendNumber(buffer, record->id);
+	appendPadding(buffer, TABLE_ID_WIDTH - length);
+
+	appendTableField(buffer, record->name, sizeof(record->name), TABLE_NAME_WIDTH);
+	appendTableField(buffer, record->surname, sizeof(record->surname), TABLE_SURNAME_WIDTH);
+	appendTableField(buffer, record->city, sizeof(record->city), TABLE_CITY_WIDTH);
+
+	appendBytes(buffer, "|\n" TABLE_SEPARATOR, sizeof("|\n" TABLE_SEPARATOR) - 1);
+}
+
+static void appendCSVRecord(exportBuffer *buffer, const Record *record)
+{
+	appendNumber(buffer, record->id);
+	buffer->data[buffer->used++] = ',';
+	appendCSVField(buffer, record->name, sizeof(record->name));
+	buffer->data[buffer->used++] = ',';
+	appendCSVField(buffer, record->surname, sizeof(record->surname));
+	buffer->data[buffer->used++] = ',';
+	appendCSVField(buffer, record->city, sizeof(record->city));
+	buffer->data[buffer->used++] = '\n';
+}
+
+SR_ErrorCode SR_ExportEntries(int fileDesc, int outputFd, SR_ExportFormat format)
+{
+	if (!isSorted(fileDesc))
+		return SR_UNSORTED;
+
+	long long blocks;
+	BF_CALL_OR_EXIT(getBlockCounter(fileDesc, &blocks));
+
+	exportBuffer buffer;
+	SR_CALL_OR_EXIT( openExport(&buffer, outputFd) );
+
+	if (format == SR_EXPORT_TABLE)
+		appendBytes(&buffer, "\n\n" TABLE_SEPARATOR TABLE_HEADER TABLE_SEPARATOR,
+		            sizeof("\n\n" TABLE_SEPARATOR TABLE_HEADER TABLE_SEPARATOR) - 1);
+	else if (format == SR_EXPORT_CSV)
+		appendBytes(&buffer, "id,name,surname,city\n", sizeof("id,name,surname,city\n") - 1);
+
+	SR_ErrorCode rv = SR_OK;
+	long long records = 0;
+
+	BF_Block * block;
+	BF_Block_Init(&block);
+
+	for (long long i = 1; i < blocks && rv == SR_OK; i++)
+	{
+		BF_ErrorCode code = getBlock(fileDesc, i, block);
+		if (code != BF_OK)
+		{
+			BF_PrintError(code);
+			rv = SR_BF_ERROR;
+			break;
+		}
+
+		char * data = BF_Block_GetData(block);
+		int blockRecords = *(int *) &data[RECORDS];
+
+		if (format == SR_EXPORT_RAW)
+		{
+			// Records are stored back to back, so a whole block goes in one copy
+			size_t length = blockRecords * sizeof(Record);
+			rv = reserveExport(&buffer, length);
+			if (rv == SR_OK)
+				appendBytes(&buffer, &data[RECORD(0)], length);
+		}
+		else
+		{
+			for (int j = 0; j < blockRecords && rv == SR_OK; j++)
+			{
+				rv = reserveExport(&buffer, EXPORT_MAX_ROW);
+				if (rv != SR_OK)
+					break;
+
+				if (format == SR_EXPORT_TABLE)
+					appendTableRecord(&buffer, (Record *) &data[RECORD(j)]);
+				else
+					appendCSVRecord(&buffer, (Record *) &data[RECORD(j)]);
+			}
+		}
+		records += blockRecords;
+
+		code = unpinBlock(block);
+		if (code != BF_OK && rv == SR_OK)
+		{
+			BF_PrintError(code);
+			rv = SR_BF_ERROR;
+		}
+	}
+
+	BF_Block_Destroy(&block);
+
+	if (rv == SR_OK && format == SR_EXPORT_TABLE)
+	{
+		char footer[64];
+		int length = snprintf(footer, sizeof(footer), "\nPrinted %lld records in %lld blocks.\n", records, blocks - 1);
+		rv = reserveExport(&buffer, length);
+		if (rv == SR_OK)
+			appendBytes(&buffer, footer, length);
+	}
+
+	SR_ErrorCode closeCode = closeExport(&buffer, rv == SR_OK);
+	if (rv == SR_OK)
+		rv = closeCode;
+
+	return rv;
+}
+
+SR_ErrorCode SR_PrintAllEntries(int fileDesc)
+{
+	if (!isSorted(fileDesc))
+		return SR_BF_ERROR;
+
+	// Anything already queued by stdio must reach stdout before our own writes
+	fflush(stdout);
+
+	return SR_ExportEntries(fileDesc, STDOUT_FILENO, SR_EXPORT_TABLE);
+}
+
+// Bytes of the source file parsed per round of the bulk loader
+#define LOAD_WINDOW_SIZE	(16 << 20)
+
+// Upper bound on the number of parser threads
+#define LOAD_MAX_THREADS	(16)
+
+// Bytes of each read of the source handed to the I/O engine
+#define LOAD_READ_SIZE		(1 << 20)
+
+typedef struct loadChunk {
+	const char *begin;	// First byte of the chunk (start of a line)
+	const char *end;	// One past the last byte (end of a line)
+	Record *records;	// Records parsed out of the chunk
+	int count;			// Number of valid entries in records
+	bool failed;		// Set if a malformed line was found
+	pthread_t thread;
+	bool threaded;		// Parsed by "thread", rather than by the calling thread
+} loadChunk;
+
+// The source, read ahead of the parser in LOAD_READ_SIZE pieces, as many at
+// once as the queue depth of the I/O engine allows
+typedef struct sourceReader {
+	ioQueue queue;
+	long long offset;	// Offset of the next read submitted, -1 if the source cannot seek
+	int next;			// Request holding the next bytes of the source
+	size_t consumed;	// Bytes of that request already handed out
+} sourceReader;
+
+// Utility Function:
+// Copies one CSV value starting at "cursor" into "field" (of "size" bytes)
+// Handles quoted values with doubled quotes, truncates anything that does not fit
+// Returns a pointer just past the value's terminator (',' or the end of the line)
+// or NULL if the value is malformed
+static const char * parseCSVField(const char *cursor, const char *lineEnd, char *field, size_t size, bool last)
+{
+	size_t length = 0;
+
+	if (cursor < lineEnd && *cursor == '"')
+	{
+		cursor++;
+		while (true)
+		{
+			if (cursor >= lineEnd)
+				return NULL;
+
+			if (*cursor == '"')
+			{
+				if (cursor + 1 < lineEnd && cursor[1] == '"')
+					cursor++;
+				else
+				{
+					cursor++;
+					break;
+				}
+			}
+			if (length < size - 1)
+				field[length++] = *cursor;
+			cursor++;
+		}
+	}
+	else
+	{
+		while (cursor < lineEnd && *cursor != ',')
+		{
+			if (length < size - 1)
+				field[length++] = *cursor;
+			cursor++;
+		}
+	}
+
+	if (last)
+		return (cursor == lineEnd) ? cursor : NULL;
+
+	return (cursor < lineEnd && *cursor == ',') ? cursor + 1 : NULL;
+}
+
+// Utility Function:
+// Returns the newline ending the CSV line that starts at "line", the first
+// one at or past "from", or NULL if the line does not end before "end"
+// Newlines inside quoted values, which appendCSVField writes for values
+// holding one, do not end the line. Toggling on every quote keeps track of
+// them, doubled quotes included
+static const char * findCSVLineEnd(const char *line, const char *from, const char *end)
+{
+	bool quoted = false;
+	for (const char *cursor = line; cursor < end; cursor++)
+	{
+		if (*cursor == '"')
+			quoted = !quoted;
+		else if (*cursor == '\n' && !quoted && cursor >= from)
+			return cursor;
+	}
+
+	return NULL;
+}
+
+// Utility Function:
+// Parses a line of the form "id,name,surname,city" into "record"
+// Returns false if the line is malformed
+static bool parseCSVLine(const char *line, const char *lineEnd, Record *record)
+{
+	memset(record, 0, sizeof(Record));
+
+	char *idEnd;
+	errno = 0;
+	long id = strtol(line, &idEnd, 10);
+	if (idEnd == line || idEnd >= lineEnd || *idEnd != ',' || errno == ERANGE || id != (int) id)
+		return false;
+	record->id = (int) id;
+
+	const char *cursor = idEnd + 1;
+	if (!(cursor = parseCSVField(cursor, lineEnd, record->name, sizeof(record->name), false)))
+		return false;
+	if (!(cursor = parseCSVField(cursor, lineEnd, record->surname, sizeof(record->surname), false)))
+		return false;
+	if (!(cursor = parseCSVField(cursor, lineEnd, record->city, sizeof(record->city), true)))
+		return false;
+
+	return true;
+}
+
+// Utility Function:
+// Thread body of the bulk loader, parses every line of a chunk
+static void * parseCSVChunk(void *arg)
+{
+	loadChunk *chunk = (loadChunk *) arg;
+
+	// Count the lines first so that exactly enough records are allocated
+	int lines = 0;
+	for (const char *cursor = chunk->begin; cursor < chunk->end; lines++)
+	{
+		const char *newline = findCSVLineEnd(cursor, cursor, chunk->end);
+		cursor = newline ? newline + 1 : chunk->end;
+	}
+
+	chunk->records = malloc((lines ? lines : 1) * sizeof(Record));
+	if (chunk->records == NULL)
+	{
+		chunk->failed = true;
+		return NULL;
+	}
+
+	const char *cursor = chunk->begin;
+	while (cursor < chunk->end)
+	{
+		const char *newline = findCSVLineEnd(cursor, cursor, chunk->end);
+		const char *lineEnd = newline ? newline : chunk->end;
+		const char *next = newline ? newline + 1 : chunk->end;
+
+		// Accept both "\n" and "\r\n" line endings
+		if (lineEnd > cursor && lineEnd[-1] == '\r')
+			lineEnd--;
+
+		// Skip empty lines
+		if (lineEnd > cursor)
+		{
+			if (!parseCSVLine(cursor, lineEnd, &chunk->records[chunk->count]))
+			{
+				fprintf(stderr, "SR bulk load: malformed line \"%.*s\"\n", (int) (lineEnd - cursor), cursor);
+				chunk->failed = true;
+				return NULL;
+			}
+			chunk->count++;
+		}
+
+		cursor = next;
+	}
+
+	return NULL;
+}
+
+// Utility Function:
+// Appends "count" records to the file, packing them in full blocks
+// Each block is pinned once, filled with memcpy and has its RECORDS count set once
+SR_ErrorCode writeLoadedRecords(loadWriter *writer, const Record *records, int count)
+{
+	while (count > 0)
+	{
+		if (writer->block == NULL)
+		{
+			BF_Block_Init(&writer->block);
+			BF_CALL_OR_EXIT(allocateBlock(writer->fileDesc, writer->block));
+			writer->data = BF_Block_GetData(writer->block);
+			writer->records = 0;
+		}
+
+		int room = MAXRECORDS - writer->records;
+		int batch = (count < room) ? count : room;
+
+		memcpy(&writer->data[RECORD(writer->records)], records, batch * sizeof(Record));
+		writer->records += batch;
+		records += batch;
+		count -= batch;
+
+		if (writer->records == MAXRECORDS)
+		{
+			memcpy(&writer->data[RECORDS], &writer->records, sizeof(int));
+			setDirty(writer->block);
+			BF_CALL_OR_EXIT(unpinBlock(writer->block));
+			BF_Block_Destroy(&writer->block);
+			writer->block = NULL;
+		}
+	}
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Writes out the last, partially filled block of the loader
+SR_ErrorCode closeLoadWriter(loadWriter *writer)
+{
+	if (writer->block != NULL)
+	{
+		memcpy(&writer->data[RECORDS], &writer->records, sizeof(int));
+		setDirty(writer->block);
+		BF_CALL_OR_EXIT(unpinBlock(writer->block));
+		BF_Block_Destroy(&writer->block);
+		writer->block = NULL;
+	}
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Splits [begin, end) in up to "threads" chunks on line boundaries,
+// parses them in parallel and appends the records in their original order
+static SR_ErrorCode loadCSVWindow(loadWriter *writer, const char *begin, const char *end, int threads)
+{
+	loadChunk chunks[LOAD_MAX_THREADS];
+	int chunkCount = 0;
+
+	size_t chunkSize = (end - begin) / threads + 1;
+	const char *cursor = begin;
+	while (cursor < end && chunkCount < threads)
+	{
+		const char *chunkEnd = end;
+		if (chunkCount < threads - 1 && (size_t) (end - cursor) > chunkSize)
+		{
+			const char *newline = findCSVLineEnd(cursor, cursor + chunkSize, end);
+			if (newline)
+				chunkEnd = newline + 1;
+		}
+
+		chunks[chunkCount].begin = cursor;
+		chunks[chunkCount].end = chunkEnd;
+		chunks[chunkCount].records = NULL;
+		chunks[chunkCount].count = 0;
+		chunks[chunkCount].failed = false;
+		chunkCount++;
+
+		cursor = chunkEnd;
+	}
+
+	// The first chunk is parsed by the calling thread
+	// as is any chunk no thread could be started for
+	for (int i = 1; i < chunkCount; i++)
+	{
+		chunks[i].threaded = (pthread_create(&chunks[i].thread, NULL, parseCSVChunk, &chunks[i]) == 0);
+		if (!chunks[i].threaded)
+			parseCSVChunk(&chunks[i]);
+	}
+	parseCSVChunk(&chunks[0]);
+
+	for (int i = 1; i < chunkCount; i++)
+		if (chunks[i].threaded)
+			pthread_join(chunks[i].thread, NULL);
+
+	SR_ErrorCode rv = SR_OK;
+	for (int i = 0; i < chunkCount; i++)
+	{
+		if (rv == SR_OK)
+			rv = chunks[i].failed ? SR_ERROR : writeLoadedRecords(writer, chunks[i].records, chunks[i].count);
+		free(chunks[i].records);
+	}
+
+	return rv;
+}
+
+// Utility Function:
+// Starts reading the source sourceFd ahead, from its current position
+// Pipes are read one piece at a time, as reads at an offset need a file
+static SR_ErrorCode openSource(sourceReader *reader, int sourceFd)
+{
+	reader->offset = (ioDepth > 1) ? lseek(sourceFd, 0, SEEK_CUR) : -1;
+	reader->next = 0;
+	reader->consumed = 0;
+	SR_CALL_OR_EXIT( openQueue(&reader->queue, sourceFd, false, (reader->offset < 0) ? 1 : ioDepth, LOAD_READ_SIZE) );
+
+	for (int i = 0; i < reader->queue.depth; i++)
+	{
+		ioRequest *request = &reader->queue.requests[i];
+		request->length = LOAD_READ_SIZE;
+		request->done = 0;
+		request->offset = reader->offset;
+		if (reader->offset >= 0)
+			reader->offset += LOAD_READ_SIZE;
+
+		SR_ErrorCode rv = submitRequest(&reader->queue, i);
+		if (rv != SR_OK)
+		{
+			closeQueue(&reader->queue);
+			return rv;
+		}
+	}
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Copies up to "size" bytes of the source into "data", like read(2)
+// but filling all of it unless the source ends first
+// Returns the number of bytes copied, 0 at the end of the source, or -1 on error
+static ssize_t readSource(sourceReader *reader, char *data, size_t size)
+{
+	size_t copied = 0;
+	while (copied < size)
+	{
+		ioRequest *request = &reader->queue.requests[reader->next];
+		while (request->busy)
+		{
+			if (waitRequest(&reader->queue) != SR_OK)
+				return -1;
+		}
+
+		// Nothing left past a read that came back empty
+		if (request->done == 0)
+			break;
+
+		size_t length = request->done - reader->consumed;
+		if (length > size - copied)
+			length = size - copied;
+		memcpy(data + copied, request->data + reader->consumed, length);
+		copied += length;
+		reader->consumed += length;
+
+		// Once handed out whole, the request reads the piece after the last one submitted
+		if (reader->consumed == request->done)
+		{
+			request->done = 0;
+			request->offset = reader->offset;
+			if (reader->offset >= 0)
+				reader->offset += LOAD_READ_SIZE;
+			if (submitRequest(&reader->queue, reader->next) != SR_OK)
+				return -1;
+
+			reader->next = (reader->next + 1) % reader->queue.depth;
+			reader->consumed = 0;
+		}
+	}
+
+	return (ssize_t) copied;
+}
+
+// Utility Function:
+// Streams the source file through a window buffer and loads it into fileDesc
+static SR_ErrorCode loadSource(int fileDesc, int sourceFd, SR_LoadFormat format)
+{
+	long processors = sysconf(_SC_NPROCESSORS_ONLN);
+	int threads = (processors < 1) ? 1 : (processors > LOAD_MAX_THREADS ? LOAD_MAX_THREADS : (int) processors);
+
+	char *window = malloc(LOAD_WINDOW_SIZE);
+	if (window == NULL)
+		return SR_ERROR;
+
+	sourceReader reader;
+	if (openSource(&reader, sourceFd) != SR_OK)
+	{
+		free(window);
+		return SR_ERROR;
+	}
+
+	loadWriter writer = { fileDesc, NULL, NULL, 0 };
+
+	SR_ErrorCode rv = SR_OK;
+	size_t carried = 0;		// Bytes of an incomplete line or record kept from the previous round
+	bool firstWindow = true, eof = false;
+
+	while (rv == SR_OK && !eof)
+	{
+		ssize_t bytes = readSource(&reader, window + carried, LOAD_WINDOW_SIZE - carried);
+		if (bytes < 0)
+		{
+			rv = SR_ERROR;
+			break;
+		}
+		eof = (bytes == 0);
+
+		size_t filled = carried + bytes;
+		size_t usable;
+
+		if (format == SR_LOAD_RAW)
+		{
+			usable = filled - (filled % sizeof(Record));
+			if (eof && usable != filled)
+			{
+				fprintf(stderr, "SR bulk load: source size is not a multiple of the record size\n");
+				rv = SR_ERROR;
+				break;
+			}
+			rv = writeLoadedRecords(&writer, (Record *) window, usable / sizeof(Record));
+		}
+		else
+		{
+			// Keep reading until the window is full, unless the source ended
+			if (!eof && filled < LOAD_WINDOW_SIZE)
+			{
+				carried = filled;
+				continue;
+			}
+
+			char *begin = window;
+			if (firstWindow && filled > 0)
+			{
+				// An optional header line is recognised by not starting with an id
+				char first = window[0];
+				if (!(first == '-' || first == '+' || (first >= '0' && first <= '9')))
+				{
+					const char *newline = findCSVLineEnd(window, window, window + filled);
+					begin = newline ? (char *) newline + 1 : window + filled;
+				}
+				firstWindow = false;
+			}
+
+			if (eof)
+				usable = filled;
+			else
+			{
+				// Only a scan from a line start tells newlines in quoted values apart
+				const char *lastNewline = NULL, *newline;
+				for (const char *line = begin; (newline = findCSVLineEnd(line, line, window + filled)); line = newline + 1)
+					lastNewline = newline;
+
+				if (lastNewline == NULL)
+				{
+					fprintf(stderr, "SR bulk load: line longer than %d bytes\n", LOAD_WINDOW_SIZE);
+					rv = SR_ERROR;
+					break;
+				}
+				usable = lastNewline + 1 - window;
+			}
+
+			if (begin < window + usable)
+				rv = loadCSVWindow(&writer, begin, window + usable, threads);
+		}
+
+		carried = filled - usable;
+		memmove(window, window + usable, carried);
+	}
+
+	free(window);
+
+	// Reads still in flight past the end of the source are waited for, and
+	// failures of reads whose bytes were never needed do not matter
+	closeQueue(&reader.queue);
+
+	if (rv == SR_OK)
+		rv = closeLoadWriter(&writer);
+	else if (writer.block != NULL)
+	{
+		unpinBlock(writer.block);
+		BF_Block_Destroy(&writer.block);
+	}
+
+	return rv;
+}
+
+SR_ErrorCode SR_BulkLoad(const char *filename, const char *source, SR_LoadFormat format)
+{
+	int sourceFd = open(source, O_RDONLY);
+	if (sourceFd < 0)
+	{
+		perror(source);
+		return SR_ERROR;
+	}
+
+	SR_ErrorCode rv = SR_CreateFile(filename);
+
+	int fileDesc;
+	if (rv == SR_OK)
+		rv = SR_OpenFile(filename, &fileDesc);
+
+	if (rv == SR_OK)
+	{
+		rv = loadSource(fileDesc, sourceFd, format);
+
+		SR_ErrorCode closeCode = SR_CloseFile(fileDesc);
+		if (rv == SR_OK)
+			rv = closeCode;
+	}
+
+	close(sourceFd);
+
+	return rv;
+}
+
+SR_ErrorCode SR_SortedBulkLoad(
+	const char *filename,
+	const char *source,
+	SR_LoadFormat format,
+	int fieldNo,
+	int bufferSize)
+{
+	// Load into a scratch file next to the output, then sort it into place
+	char loadName[4096];
+	if (snprintf(loadName, sizeof(loadName), "%s.load", filename) >= (int) sizeof(loadName))
+		return SR_ERROR;
+
+	SR_CALL_OR_EXIT( SR_BulkLoad(loadName, source, format) );
+
+	SR_ErrorCode rv = SR_SortedFile(loadName, filename, fieldNo, bufferSize);
+	removeFile(loadName);
+
+	return rv;
+}
@@ -0,0 +1,498 @@
+#include "sort_file_internal.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Layout of an index file's META block, right after the identifier
+// Block numbers are long longs, every other value an int
+#define INDEX_FIELD		(sizeof(int))			// Field the index was built on
+#define INDEX_HEIGHT	(2 * sizeof(int))		// Levels of the tree, leaves included
+#define INDEX_ROOT		(2 * sizeof(long long))	// Block number of the root node
+#define INDEX_ENTRIES	(3 * sizeof(long long))	// Total number of entries in the leaves
+
+// Every node stores its number of entries at data[NODE_COUNT]
+// Leaves store the block number of the next leaf (-1 for the last one)
+// and internal nodes the block number of their leftmost child at data[NODE_LINK]
+#define NODE_COUNT		(0)
+#define NODE_LINK		(sizeof(long long))
+#define NODE_HEADER		(2 * sizeof(long long))
+
+// Used in indexing a node's entries, each one is "size" bytes long
+// An entry is a key followed by a RID in leaves, or by a block number in internal nodes
+#define NODE_ENTRY(i, size)	( NODE_HEADER + ((size) * (i)) )
+#define ENTRY_SIZE(fieldNo)	( fieldSize(fieldNo) + sizeof(long long) )
+
+// A record's location in the base file, encoded as a single long long
+#define RID(block, slot)	( (block) * (long long) MAXRECORDS + (slot) )
+#define RID_BLOCK(rid)		( (rid) / (long long) MAXRECORDS )
+#define RID_SLOT(rid)		( (int) ((rid) % (long long) MAXRECORDS) )
+
+// Utility Function:
+// Compares a key stored in an index node with the field of "record"
+// Returns a negative, zero or positive value, like strcmp
+static int compareKey(const char *key, const Record *record, const int fieldNo)
+{
+	if (fieldNo == 0)
+	{
+		int id;
+		memcpy(&id, key, sizeof(int));
+		return (id > record->id) - (id < record->id);
+	}
+
+	return strncmp(key, recordField(record, fieldNo), fieldSize(fieldNo));
+}
+
+// Utility Function:
+// Each sorted key file entry is a Record holding the key in its usual field
+// and the RID of the record it came from in a string field that is not the key
+static char * entryRID(Record *entry, const int fieldNo)
+{
+	return (fieldNo == 1) ? entry->surname : entry->name;
+}
+
+typedef struct indexLevel {
+	char *keys;			// First key of every node of the level
+	long long *blocks;	// Block number of every node of the level
+	int count;
+	int capacity;
+} indexLevel;
+
+static SR_ErrorCode pushIndexLevel(indexLevel *level, const char *key, int keySize, long long block)
+{
+	if (level->count == level->capacity)
+	{
+		int capacity = level->capacity ? 2 * level->capacity : 64;
+		char *keys = realloc(level->keys, (size_t) capacity * keySize);
+		if (keys == NULL)
+			return SR_ERROR;
+		level->keys = keys;
+
+		long long *blocks = realloc(level->blocks, (size_t) capacity * sizeof(long long));
+		if (blocks == NULL)
+			return SR_ERROR;
+		level->blocks = blocks;
+
+		level->capacity = capacity;
+	}
+
+	memcpy(&level->keys[(size_t) level->count * keySize], key, keySize);
+	level->blocks[level->count++] = block;
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Extracts a (key, RID) entry for every record of the base file
+// into the sorted-format file keysDesc
+static SR_ErrorCode extractIndexEntries(int baseDesc, int keysDesc, int fieldNo)
+{
+	long long blocks;
+	BF_CALL_OR_EXIT(getBlockCounter(baseDesc, &blocks));
+
+	Record entries[MAXRECORDS];
+	loadWriter writer = { keysDesc, NULL, NULL, 0 };
+
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	for (long long i = 1; i < blocks; i++)
+	{
+		BF_CALL_OR_EXIT(getBlock(baseDesc, i, block));
+		char *data = BF_Block_GetData(block);
+
+		int records = *(int *) &data[RECORDS];
+		for (int j = 0; j < records; j++)
+		{
+			Record *record = (Record *) &data[RECORD(j)];
+			memset(&entries[j], 0, sizeof(Record));
+			memcpy(recordField(&entries[j], fieldNo), recordField(record, fieldNo), fieldSize(fieldNo));
+
+			long long rid = RID(i, j);
+			memcpy(entryRID(&entries[j], fieldNo), &rid, sizeof(long long));
+		}
+
+		BF_CALL_OR_EXIT(unpinBlock(block));
+		SR_CALL_OR_EXIT( writeLoadedRecords(&writer, entries, records) );
+	}
+
+	BF_Block_Destroy(&block);
+
+	return closeLoadWriter(&writer);
+}
+
+// Utility Function:
+// Packs the sorted entries of sortedDesc into leaves, appended to indexDesc
+// The first key and block number of every leaf is collected into "leaves"
+static SR_ErrorCode buildLeaves(int sortedDesc, int indexDesc, int fieldNo, indexLevel *leaves, long long *entryCount)
+{
+	int keySize = fieldSize(fieldNo), entrySize = ENTRY_SIZE(fieldNo);
+	int capacity = (BF_BLOCK_SIZE - NODE_HEADER) / entrySize;
+
+	long long blocks;
+	BF_CALL_OR_EXIT(getBlockCounter(sortedDesc, &blocks));
+
+	BF_Block *block, *leaf;
+	BF_Block_Init(&block);
+	BF_Block_Init(&leaf);
+
+	// Leaves are allocated one after the other, starting right after META
+	long long leafBlock = 0;
+	int leafCount = 0;
+	char *leafData = NULL;
+	*entryCount = 0;
+
+	for (long long i = 1; i < blocks; i++)
+	{
+		BF_CALL_OR_EXIT(getBlock(sortedDesc, i, block));
+		char *data = BF_Block_GetData(block);
+
+		int records = *(int *) &data[RECORDS];
+		for (int j = 0; j < records; j++)
+		{
+			Record *entry = (Record *) &data[RECORD(j)];
+
+			// Only link a full leaf to the next one once we know there is a next one
+			if (leafData == NULL || leafCount == capacity)
+			{
+				if (leafData != NULL)
+				{
+					long long next = leafBlock + 1;
+					memcpy(&leafData[NODE_LINK], &next, sizeof(long long));
+					setDirty(leaf);
+					BF_CALL_OR_EXIT(unpinBlock(leaf));
+				}
+
+				BF_CALL_OR_EXIT(allocateBlock(indexDesc, leaf));
+				leafData = BF_Block_GetData(leaf);
+				leafBlock++;
+				leafCount = 0;
+
+				SR_CALL_OR_EXIT( pushIndexLevel(leaves, recordField(entry, fieldNo), keySize, leafBlock) );
+			}
+
+			char *slot = &leafData[NODE_ENTRY(leafCount, entrySize)];
+			memcpy(slot, recordField(entry, fieldNo), keySize);
+			memcpy(slot + keySize, entryRID(entry, fieldNo), sizeof(long long));
+
+			leafCount++;
+			memcpy(&leafData[NODE_COUNT], &leafCount, sizeof(int));
+			(*entryCount)++;
+		}
+
+		BF_CALL_OR_EXIT(unpinBlock(block));
+	}
+
+	// An empty base file still gets an (empty) leaf, so that the root always exists
+	if (leafData == NULL)
+	{
+		BF_CALL_OR_EXIT(allocateBlock(indexDesc, leaf));
+		leafData = BF_Block_GetData(leaf);
+		leafBlock++;
+		memset(&leafData[NODE_COUNT], 0, sizeof(int));
+
+		char emptyKey[sizeof(Record)] = { 0 };
+		SR_CALL_OR_EXIT( pushIndexLevel(leaves, emptyKey, keySize, leafBlock) );
+	}
+
+	long long last = -1;
+	memcpy(&leafData[NODE_LINK], &last, sizeof(long long));
+	setDirty(leaf);
+	BF_CALL_OR_EXIT(unpinBlock(leaf));
+
+	BF_Block_Destroy(&leaf);
+	BF_Block_Destroy(&block);
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Builds one level of internal nodes over the nodes of "children"
+// The first key and block number of every new node is collected into "parents"
+static SR_ErrorCode buildInternalLevel(int indexDesc, int fieldNo, const indexLevel *children, indexLevel *parents)
+{
+	int keySize = fieldSize(fieldNo), entrySize = ENTRY_SIZE(fieldNo);
+	int capacity = (BF_BLOCK_SIZE - NODE_HEADER) / entrySize;
+
+	long long nodeBlock;
+	BF_CALL_OR_EXIT(getBlockCounter(indexDesc, &nodeBlock));
+
+	BF_Block *node;
+	BF_Block_Init(&node);
+
+	// Every node holds its leftmost child in the header plus up to "capacity" more
+	for (int i = 0; i < children->count; nodeBlock++)
+	{
+		BF_CALL_OR_EXIT(allocateBlock(indexDesc, node));
+		char *data = BF_Block_GetData(node);
+
+		SR_CALL_OR_EXIT( pushIndexLevel(parents, &children->keys[(size_t) i * keySize], keySize, nodeBlock) );
+		memcpy(&data[NODE_LINK], &children->blocks[i++], sizeof(long long));
+
+		int count = 0;
+		for (; count < capacity && i < children->count; count++, i++)
+		{
+			char *slot = &data[NODE_ENTRY(count, entrySize)];
+			memcpy(slot, &children->keys[(size_t) i * keySize], keySize);
+			memcpy(slot + keySize, &children->blocks[i], sizeof(long long));
+		}
+		memcpy(&data[NODE_COUNT], &count, sizeof(int));
+
+		setDirty(node);
+		BF_CALL_OR_EXIT(unpinBlock(node));
+	}
+
+	BF_Block_Destroy(&node);
+
+	return SR_OK;
+}
+
+static SR_ErrorCode buildIndex(const char *input_filename, const char *index_filename,
+                               const char *keysName, const char *sortedName, int fieldNo, int bufferSize)
+{
+	// Stream a (key, RID) entry per record through the external sort
+	int baseDesc, keysDesc;
+	SR_CALL_OR_EXIT( SR_OpenFile(input_filename, &baseDesc) );
+	SR_CALL_OR_EXIT( SR_CreateFile(keysName) );
+	SR_CALL_OR_EXIT( SR_OpenFile(keysName, &keysDesc) );
+	SR_CALL_OR_EXIT( extractIndexEntries(baseDesc, keysDesc, fieldNo) );
+	SR_CALL_OR_EXIT( SR_CloseFile(keysDesc) );
+	SR_CALL_OR_EXIT( SR_CloseFile(baseDesc) );
+
+	SR_CALL_OR_EXIT( SR_SortedFile(keysName, sortedName, fieldNo, bufferSize) );
+
+	// Pack the sorted entries bottom-up, leaves first
+	int indexDesc, sortedDesc;
+	BF_CALL_OR_EXIT(createBlockFile(index_filename));
+	BF_CALL_OR_EXIT(openBlockFile(index_filename, &indexDesc));
+
+	BF_Block *meta;
+	BF_Block_Init(&meta);
+	BF_CALL_OR_EXIT(allocateBlock(indexDesc, meta));
+	BF_CALL_OR_EXIT(unpinBlock(meta));
+
+	indexLevel level = { NULL, NULL, 0, 0 };
+	long long entries;
+	SR_CALL_OR_EXIT( SR_OpenFile(sortedName, &sortedDesc) );
+	SR_CALL_OR_EXIT( buildLeaves(sortedDesc, indexDesc, fieldNo, &level, &entries) );
+	SR_CALL_OR_EXIT( SR_CloseFile(sortedDesc) );
+
+	int height = 1;
+	while (level.count > 1)
+	{
+		indexLevel parents = { NULL, NULL, 0, 0 };
+		SR_CALL_OR_EXIT( buildInternalLevel(indexDesc, fieldNo, &level, &parents) );
+
+		free(level.keys);
+		free(level.blocks);
+		level = parents;
+		height++;
+	}
+
+	BF_CALL_OR_EXIT(getBlock(indexDesc, META, meta));
+	char *data = BF_Block_GetData(meta);
+	data[IDENTIFIER] = INDEXED;
+	memcpy(&data[INDEX_FIELD], &fieldNo, sizeof(int));
+	memcpy(&data[INDEX_ROOT], &level.blocks[0], sizeof(long long));
+	memcpy(&data[INDEX_HEIGHT], &height, sizeof(int));
+	memcpy(&data[INDEX_ENTRIES], &entries, sizeof(long long));
+	setDirty(meta);
+	BF_CALL_OR_EXIT(unpinBlock(meta));
+	BF_Block_Destroy(&meta);
+
+	free(level.keys);
+	free(level.blocks);
+
+	BF_CALL_OR_EXIT(closeBlockFile(indexDesc));
+
+	return SR_OK;
+}
+
+SR_ErrorCode SR_CreateIndex(
+	const char *input_filename,
+	const char *index_filename,
+	int fieldNo,
+	int bufferSize)
+{
+	if (fieldNo < 0 || fieldNo > 3)
+		return SR_ERROR;
+
+	char keysName[4096], sortedName[4096];
+	if (snprintf(keysName, sizeof(keysName), "%s.keys", index_filename) >= (int) sizeof(keysName) ||
+	    snprintf(sortedName, sizeof(sortedName), "%s.sorted", index_filename) >= (int) sizeof(sortedName))
+		return SR_ERROR;
+
+	SR_ErrorCode rv = buildIndex(input_filename, index_filename, keysName, sortedName, fieldNo, bufferSize);
+
+	removeFile(keysName);
+	removeFile(sortedName);
+
+	return rv;
+}
+
+// Utility Function:
+// Assumes the file has already been opened
+// Checks if its identifier corresponds to that of an index file
+// and if so reads the index's field, root and height from the META block
+static SR_ErrorCode readIndexMeta(const int indexDesc, int *fieldNo, long long *root, int *height)
+{
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	BF_CALL_OR_EXIT(getBlock(indexDesc, META, block));
+	char *data = BF_Block_GetData(block);
+
+	bool indexed = (data[IDENTIFIER] == INDEXED);
+	memcpy(fieldNo, &data[INDEX_FIELD], sizeof(int));
+	memcpy(root, &data[INDEX_ROOT], sizeof(long long));
+	memcpy(height, &data[INDEX_HEIGHT], sizeof(int));
+
+	BF_CALL_OR_EXIT(unpinBlock(block));
+	BF_Block_Destroy(&block);
+
+	return indexed ? SR_OK : SR_ERROR;
+}
+
+SR_ErrorCode SR_OpenIndex(const char *index_filename, int *indexDesc)
+{
+	BF_CALL_OR_EXIT(openBlockFile(index_filename, indexDesc));
+
+	int fieldNo, height;
+	long long root;
+	if (readIndexMeta(*indexDesc, &fieldNo, &root, &height) != SR_OK)
+	{
+		BF_CALL_OR_EXIT(closeBlockFile(*indexDesc));
+		return SR_ERROR;
+	}
+
+	return SR_OK;
+}
+
+SR_ErrorCode SR_CloseIndex(int indexDesc)
+{
+	BF_CALL_OR_EXIT(closeBlockFile(indexDesc));
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Returns the number of entries of a node whose key is lesser than the field of "key"
+static int nodeLowerBound(const char *data, const Record *key, int fieldNo)
+{
+	int entrySize = ENTRY_SIZE(fieldNo);
+	int lo = 0, hi = *(int *) &data[NODE_COUNT];
+
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+
+		if (compareKey(&data[NODE_ENTRY(mid, entrySize)], key, fieldNo) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+SR_ErrorCode SR_IndexRangeScan(
+	int indexDesc,
+	int fileDesc,
+	const Record *low,
+	const Record *high,
+	SR_RecordCallback callback,
+	void *context)
+{
+	int fieldNo, height;
+	long long node;
+	SR_CALL_OR_EXIT( readIndexMeta(indexDesc, &fieldNo, &node, &height) );
+
+	int keySize = fieldSize(fieldNo), entrySize = ENTRY_SIZE(fieldNo);
+
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	// Descend to the leftmost leaf that may hold "low"
+	// Each separator is the first key of its child, so when duplicates of "low"
+	// span several children the search has to start from the one before
+	for (int level = 1; level < height; level++)
+	{
+		BF_CALL_OR_EXIT(getBlock(indexDesc, node, block));
+		char *data = BF_Block_GetData(block);
+
+		int pos = (low != NULL) ? nodeLowerBound(data, low, fieldNo) : 0;
+		if (pos == 0)
+			memcpy(&node, &data[NODE_LINK], sizeof(long long));
+		else
+			memcpy(&node, &data[NODE_ENTRY(pos - 1, entrySize) + keySize], sizeof(long long));
+
+		BF_CALL_OR_EXIT(unpinBlock(block));
+	}
+
+	BF_CALL_OR_EXIT(getBlock(indexDesc, node, block));
+	char *data = BF_Block_GetData(block);
+
+	// Base blocks are pinned one at a time and kept while consecutive entries point into them
+	BF_Block *base;
+	BF_Block_Init(&base);
+	long long baseBlock = -1;
+	char *baseData = NULL;
+
+	int pos = (low != NULL) ? nodeLowerBound(data, low, fieldNo) : 0;
+	bool done = false;
+	while (!done)
+	{
+		int count = *(int *) &data[NODE_COUNT];
+		for (; pos < count; pos++)
+		{
+			char *entry = &data[NODE_ENTRY(pos, entrySize)];
+			if (high != NULL && compareKey(entry, high, fieldNo) > 0)
+			{
+				done = true;
+				break;
+			}
+
+			long long rid;
+			memcpy(&rid, entry + keySize, sizeof(long long));
+			if (RID_BLOCK(rid) != baseBlock)
+			{
+				if (baseData != NULL)
+					BF_CALL_OR_EXIT(unpinBlock(base));
+
+				baseBlock = RID_BLOCK(rid);
+				BF_CALL_OR_EXIT(getBlock(fileDesc, baseBlock, base));
+				baseData = BF_Block_GetData(base);
+			}
+
+			callback((Record *) &baseData[RECORD(RID_SLOT(rid))], context);
+		}
+
+		long long next;
+		memcpy(&next, &data[NODE_LINK], sizeof(long long));
+		BF_CALL_OR_EXIT(unpinBlock(block));
+
+		if (done || next < 0)
+			break;
+
+		BF_CALL_OR_EXIT(getBlock(indexDesc, next, block));
+		data = BF_Block_GetData(block);
+		pos = 0;
+	}
+
+	if (baseData != NULL)
+		BF_CALL_OR_EXIT(unpinBlock(base));
+
+	BF_Block_Destroy(&base);
+	BF_Block_Destroy(&block);
+
+	return SR_OK;
+}
+
+SR_ErrorCode SR_IndexSearch(
+	int indexDesc,
+	int fileDesc,
+	const Record *key,
+	SR_RecordCallback callback,
+	void *context)
+{
+	return SR_IndexRangeScan(indexDesc, fileDesc, key, key, callback, context);
+}
@@ -0,0 +1,352 @@
+#include "sort_file_internal.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// io_uring is driven through its system calls, as liburing is not a dependency
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef __NR_io_uring_setup
+#define SR_HAVE_IO_URING
+#endif
+#endif
+#endif
+
+// Engine and queue depth of the following loads and exports, see SR_SetIOEngine
+SR_IOEngine ioEngine = SR_IO_SYNC;
+int ioDepth = 1;
+
+#ifdef SR_HAVE_IO_URING
+// The rings shared with the kernel, set up with the raw system calls
+typedef struct ioRing {
+	int fd;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sqMap;		// Submission ring, and completion ring with IORING_FEAT_SINGLE_MMAP
+	void *cqMap;
+	size_t sqMapSize;
+	size_t cqMapSize;
+	size_t sqesSize;
+} ioRing;
+#endif
+
+#ifdef SR_HAVE_IO_URING
+// Utility Function:
+// Sets up an io_uring instance of "entries" entries
+// Returns false if the kernel refuses it, e.g. for being too old
+static bool setupRing(ioRing *ring, unsigned entries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	memset(ring, 0, sizeof(ioRing));
+
+	ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0)
+		return false;
+
+	ring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cqMapSize > ring->sqMapSize)
+			ring->sqMapSize = ring->cqMapSize;
+		ring->cqMapSize = 0;
+	}
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sqMap = mmap(NULL, ring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                   ring->fd, IORING_OFF_SQ_RING);
+	ring->cqMap = (ring->cqMapSize == 0) ? ring->sqMap :
+	              mmap(NULL, ring->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                   ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                  ring->fd, IORING_OFF_SQES);
+	if (ring->sqMap == MAP_FAILED || ring->cqMap == MAP_FAILED || ring->sqes == MAP_FAILED)
+	{
+		if (ring->sqMap != MAP_FAILED)
+			munmap(ring->sqMap, ring->sqMapSize);
+		if (ring->cqMapSize != 0 && ring->cqMap != MAP_FAILED)
+			munmap(ring->cqMap, ring->cqMapSize);
+		if (ring->sqes != MAP_FAILED)
+			munmap(ring->sqes, ring->sqesSize);
+		close(ring->fd);
+		return false;
+	}
+
+	char *sq = ring->sqMap, *cq = ring->cqMap;
+	ring->sqTail = (unsigned *) (sq + params.sq_off.tail);
+	ring->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned *) (sq + params.sq_off.array);
+	ring->cqHead = (unsigned *) (cq + params.cq_off.head);
+	ring->cqTail = (unsigned *) (cq + params.cq_off.tail);
+	ring->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+	return true;
+}
+
+static void closeRing(ioRing *ring)
+{
+	munmap(ring->sqes, ring->sqesSize);
+	if (ring->cqMapSize != 0)
+		munmap(ring->cqMap, ring->cqMapSize);
+	munmap(ring->sqMap, ring->sqMapSize);
+	close(ring->fd);
+}
+
+// Utility Function:
+// Calls io_uring_enter, retrying when interrupted
+static int enterRing(ioRing *ring, unsigned submit, unsigned wait)
+{
+	int rv;
+	do
+		rv = (int) syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+		                   wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	while (rv < 0 && errno == EINTR);
+
+	return rv;
+}
+#endif
+
+// Utility Function:
+// Sets up a queue of "depth" buffers of "size" bytes for the file descriptor fd
+// with the engine chosen by SR_SetIOEngine, or SR_IO_SYNC if it is not available
+SR_ErrorCode openQueue(ioQueue *queue, int fd, bool write, int depth, size_t size)
+{
+	memset(queue, 0, sizeof(ioQueue));
+	queue->engine = ioEngine;
+	queue->fd = fd;
+	queue->write = write;
+	queue->depth = depth;
+
+	queue->buffers = malloc(depth * size);
+	if (queue->buffers == NULL)
+		return SR_ERROR;
+	for (int i = 0; i < depth; i++)
+		queue->requests[i].data = queue->buffers + i * size;
+
+#ifdef SR_HAVE_IO_URING
+	if (queue->engine == SR_IO_URING)
+	{
+		queue->ring = malloc(sizeof(ioRing));
+		if (queue->ring == NULL || !setupRing(queue->ring, depth))
+		{
+			free(queue->ring);
+			queue->ring = NULL;
+			queue->engine = SR_IO_SYNC;
+		}
+	}
+#else
+	queue->engine = SR_IO_SYNC;
+#endif
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Starts the transfer of what is left of request i
+// With SR_IO_SYNC it is carried out right away: reads at an offset and writes
+// go on until they are complete, like the io_uring completions below
+SR_ErrorCode submitRequest(ioQueue *queue, int i)
+{
+	ioRequest *request = &queue->requests[i];
+	request->busy = true;
+
+#ifdef SR_HAVE_IO_URING
+	if (queue->engine == SR_IO_URING)
+	{
+		ioRing *ring = queue->ring;
+
+		// At most depth requests are in flight, so the ring always has room
+		unsigned tail = *ring->sqTail;
+		unsigned index = tail & *ring->sqMask;
+		struct io_uring_sqe *sqe = &ring->sqes[index];
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		sqe->opcode = queue->write ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd = queue->fd;
+		sqe->addr = (unsigned long long) (uintptr_t) (request->data + request->done);
+		sqe->len = (unsigned) (request->length - request->done);
+		sqe->off = (request->offset < 0) ? (unsigned long long) -1 : (unsigned long long) (request->offset + request->done);
+		sqe->user_data = (unsigned long long) i;
+		ring->sqArray[index] = index;
+		__atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+		if (enterRing(ring, 1, 0) < 0)
+		{
+			perror("SR io_uring");
+			request->busy = false;
+			return SR_ERROR;
+		}
+		return SR_OK;
+	}
+#endif
+
+	while (request->done < request->length)
+	{
+		char *data = request->data + request->done;
+		size_t length = request->length - request->done;
+		ssize_t rv;
+		if (request->offset < 0)
+			rv = queue->write ? write(queue->fd, data, length) : read(queue->fd, data, length);
+		else
+		{
+			off_t offset = (off_t) (request->offset + request->done);
+			rv = queue->write ? pwrite(queue->fd, data, length, offset) : pread(queue->fd, data, length, offset);
+		}
+
+		if (rv < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror(queue->write ? "SR export" : "SR bulk load");
+			request->busy = false;
+			return SR_ERROR;
+		}
+		request->done += (size_t) rv;
+
+		if (rv == 0 && queue->write)
+		{
+			fprintf(stderr, "SR export: write made no progress\n");
+			request->busy = false;
+			return SR_ERROR;
+		}
+		// The end of the file, or a read from a pipe, which returns what it has
+		if (rv == 0 || (!queue->write && request->offset < 0))
+			break;
+	}
+	request->busy = false;
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Waits until one more of the busy requests of the queue completes
+SR_ErrorCode waitRequest(ioQueue *queue)
+{
+#ifdef SR_HAVE_IO_URING
+	if (queue->engine == SR_IO_URING)
+	{
+		ioRing *ring = queue->ring;
+		for (;;)
+		{
+			unsigned head = *ring->cqHead;
+			if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+			{
+				if (enterRing(ring, 0, 1) < 0)
+				{
+					perror("SR io_uring");
+					return SR_ERROR;
+				}
+				continue;
+			}
+
+			struct io_uring_cqe cqe = ring->cqes[head & *ring->cqMask];
+			__atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+
+			ioRequest *request = &queue->requests[cqe.user_data];
+			if (cqe.res < 0)
+			{
+				if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+				{
+					SR_CALL_OR_EXIT( submitRequest(queue, (int) cqe.user_data) );
+					continue;
+				}
+				request->busy = false;
+				errno = -cqe.res;
+				perror(queue->write ? "SR export" : "SR bulk load");
+				return SR_ERROR;
+			}
+			request->done += (size_t) cqe.res;
+
+			// Short transfers go on where they stopped, as write(2) callers do
+			if (cqe.res > 0 && request->done < request->length && (queue->write || request->offset >= 0))
+			{
+				SR_CALL_OR_EXIT( submitRequest(queue, (int) cqe.user_data) );
+				continue;
+			}
+			if (cqe.res == 0 && queue->write)
+			{
+				request->busy = false;
+				fprintf(stderr, "SR export: write made no progress\n");
+				return SR_ERROR;
+			}
+
+			request->busy = false;
+			return SR_OK;
+		}
+	}
+#endif
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Waits for every busy request, then frees the queue
+// Returns the first error any of them ended with
+SR_ErrorCode closeQueue(ioQueue *queue)
+{
+	SR_ErrorCode rv = SR_OK;
+	for (int i = 0; i < queue->depth; i++)
+	{
+		while (queue->requests[i].busy)
+		{
+			SR_ErrorCode code = waitRequest(queue);
+			if (code != SR_OK)
+			{
+				if (rv == SR_OK)
+					rv = code;
+				// The ring can no longer be trusted to report the rest
+				if (queue->requests[i].busy)
+					break;
+			}
+		}
+	}
+
+#ifdef SR_HAVE_IO_URING
+	if (queue->engine == SR_IO_URING)
+	{
+		closeRing(queue->ring);
+		free(queue->ring);
+	}
+#endif
+	free(queue->buffers);
+
+	return rv;
+}
+
+SR_ErrorCode SR_SetIOEngine(SR_IOEngine engine, int queueDepth)
+{
+	if (queueDepth < 1 || queueDepth > SR_MAX_IO_DEPTH)
+		return SR_ERROR;
+
+	if (engine == SR_IO_URING)
+	{
+#ifdef SR_HAVE_IO_URING
+		ioRing ring;
+		if (!setupRing(&ring, queueDepth))
+			return SR_ERROR;
+		closeRing(&ring);
+#else
+		return SR_ERROR;
+#endif
+	}
+	else if (engine != SR_IO_SYNC)
+		return SR_ERROR;
+
+	ioEngine = engine;
+	ioDepth = queueDepth;
+
+	return SR_OK;
+}
@@ -0,0 +1,368 @@
+#include "sort_file_internal.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+// Number of records of a duplicate key group the join keeps in memory
+// per block of its memory budget not used for pinning input blocks
+#define JOIN_PINNED_BLOCKS	(3)
+
+typedef struct joinCursor {
+	int fileDesc;		// File being scanned
+	long long blocks;	// Number of blocks of the file
+	long long blockCounter;	// Block currently pinned
+	int iterator;		// Current record inside the block
+	int records;		// Records of the current block
+	BF_Block *block;	// Current block, NULL once the file is exhausted
+	char *data;			// Data of current block
+
+	// Another cursor over the same file, or NULL, see pinSharedBlock
+	// It must stay put until this cursor is closed
+	const struct joinCursor *owner;
+} joinCursor;
+
+// Utility Function:
+// Lets go of the current block of the cursor, sharing the pin of its owner
+static SR_ErrorCode releaseCursorBlock(joinCursor *cursor)
+{
+	const joinCursor *owner = cursor->owner;
+	BF_CALL_OR_EXIT(unpinSharedBlock(&cursor->block, false, owner ? owner->block : NULL));
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Skips empty blocks and pins the first one holding a record at or after
+// (blockCounter, iterator), or leaves the cursor exhausted
+static SR_ErrorCode seekCursor(joinCursor *cursor)
+{
+	while (cursor->blockCounter < cursor->blocks)
+	{
+		if (cursor->block == NULL)
+		{
+			const joinCursor *owner = cursor->owner;
+			BF_CALL_OR_EXIT(pinSharedBlock(cursor->fileDesc, cursor->blockCounter, &cursor->block,
+			                               owner ? owner->block : NULL, owner ? owner->blockCounter : 0));
+			cursor->data = BF_Block_GetData(cursor->block);
+			cursor->records = *(int *) &cursor->data[RECORDS];
+		}
+
+		if (cursor->iterator < cursor->records)
+			return SR_OK;
+
+		SR_CALL_OR_EXIT( releaseCursorBlock(cursor) );
+		cursor->blockCounter++;
+		cursor->iterator = 0;
+	}
+
+	return SR_OK;
+}
+
+// The cursor starts at (blockCounter, iterator) of the file fileDesc
+// owner, if not NULL, is another cursor over the same file
+static SR_ErrorCode openCursor(joinCursor *cursor, int fileDesc, long long blockCounter, int iterator,
+                               const joinCursor *owner)
+{
+	cursor->fileDesc = fileDesc;
+	cursor->blockCounter = blockCounter;
+	cursor->iterator = iterator;
+	cursor->block = NULL;
+	cursor->data = NULL;
+	cursor->owner = owner;
+	BF_CALL_OR_EXIT(getBlockCounter(fileDesc, &cursor->blocks));
+
+	return seekCursor(cursor);
+}
+
+static SR_ErrorCode advanceCursor(joinCursor *cursor)
+{
+	cursor->iterator++;
+
+	return seekCursor(cursor);
+}
+
+static SR_ErrorCode closeCursor(joinCursor *cursor)
+{
+	if (cursor->block != NULL)
+		SR_CALL_OR_EXIT( releaseCursorBlock(cursor) );
+
+	return SR_OK;
+}
+
+#define CURSOR_VALID(cursor)	((cursor)->block != NULL)
+#define CURSOR_RECORD(cursor)	((Record *) &(cursor)->data[RECORD((cursor)->iterator)])
+
+// Utility Function:
+// Makes sure the open file fileDesc is sorted on fieldNo
+// If its META block says otherwise, it is sorted into sortedName and *joinDesc
+// is set to the sorted copy, else *joinDesc is fileDesc itself
+static SR_ErrorCode prepareJoinInput(int fileDesc, const char *sortedName, int fieldNo, int bufferSize, int *joinDesc)
+{
+	if (sortedOn(fileDesc) == fieldNo)
+	{
+		*joinDesc = fileDesc;
+		return SR_OK;
+	}
+
+	sortMode mode;
+	initSortMode(&mode, fieldNo);
+	removeFile(sortedName);
+	SR_CALL_OR_EXIT( sortFile(fileDesc, sortedName, &mode, bufferSize, NULL, NULL) );
+	SR_CALL_OR_EXIT( SR_OpenFile(sortedName, joinDesc) );
+
+	return SR_OK;
+}
+
+static SR_ErrorCode mergeJoin(int fdA, int fdB, int fieldNo, int bufferSize, SR_JoinCallback callback, void *context)
+{
+	// Whatever the memory budget leaves after pinning the two inputs and
+	// the cursor used to rescan oversized groups holds a group of equal keys of B
+	int capacity = (bufferSize - JOIN_PINNED_BLOCKS) * MAXRECORDS;
+	Record *group = malloc((capacity ? capacity : 1) * sizeof(Record));
+	if (group == NULL)
+		return SR_ERROR;
+
+	joinCursor a, b;
+	SR_CALL_OR_EXIT( openCursor(&a, fdA, 1, 0, NULL) );
+	SR_CALL_OR_EXIT( openCursor(&b, fdB, 1, 0, NULL) );
+
+	while (CURSOR_VALID(&a) && CURSOR_VALID(&b))
+	{
+		if (compareRecord(CURSOR_RECORD(&a), CURSOR_RECORD(&b), fieldNo))
+		{
+			SR_CALL_OR_EXIT( advanceCursor(&a) );
+			continue;
+		}
+		if (compareRecord(CURSOR_RECORD(&b), CURSOR_RECORD(&a), fieldNo))
+		{
+			SR_CALL_OR_EXIT( advanceCursor(&b) );
+			continue;
+		}
+
+		// Both inputs are at the same key
+		// Buffer B's group of that key, remembering where it started in case it does not fit
+		Record key;
+		memcpy(&key, CURSOR_RECORD(&b), sizeof(Record));
+		long long groupBlock = b.blockCounter;
+		int groupIterator = b.iterator;
+
+		int groupSize = 0;
+		bool overflow = false;
+		while (CURSOR_VALID(&b) && !compareRecord(&key, CURSOR_RECORD(&b), fieldNo))
+		{
+			if (groupSize < capacity)
+				memcpy(&group[groupSize++], CURSOR_RECORD(&b), sizeof(Record));
+			else
+				overflow = true;
+
+			SR_CALL_OR_EXIT( advanceCursor(&b) );
+		}
+
+		// Pair every record of A's group with B's group
+		while (CURSOR_VALID(&a) && !compareRecord(&key, CURSOR_RECORD(&a), fieldNo))
+		{
+			if (!overflow)
+			{
+				for (int i = 0; i < groupSize; i++)
+					callback(CURSOR_RECORD(&a), &group[i], context);
+			}
+			else
+			{
+				// b stays put on the block after the group meanwhile, which
+				// may well be the last block of the group
+				joinCursor rescan;
+				SR_CALL_OR_EXIT( openCursor(&rescan, fdB, groupBlock, groupIterator, &b) );
+				while (CURSOR_VALID(&rescan) && !compareRecord(&key, CURSOR_RECORD(&rescan), fieldNo))
+				{
+					callback(CURSOR_RECORD(&a), CURSOR_RECORD(&rescan), context);
+					SR_CALL_OR_EXIT( advanceCursor(&rescan) );
+				}
+				SR_CALL_OR_EXIT( closeCursor(&rescan) );
+			}
+
+			SR_CALL_OR_EXIT( advanceCursor(&a) );
+		}
+	}
+
+	SR_CALL_OR_EXIT( closeCursor(&a) );
+	SR_CALL_OR_EXIT( closeCursor(&b) );
+	free(group);
+
+	return SR_OK;
+}
+
+SR_ErrorCode SR_MergeJoin(
+	int fdA,
+	int fdB,
+	int fieldNo,
+	int bufferSize,
+	SR_JoinCallback callback,
+	void *context)
+{
+	if (fieldNo < 0 || fieldNo > 3 || bufferSize < JOIN_PINNED_BLOCKS || bufferSize > BF_BUFFER_SIZE)
+		return SR_ERROR;
+
+	if (!isSorted(fdA) || !isSorted(fdB))
+		return SR_UNSORTED;
+
+	char sortedNames[2][TEMP_PATH_SIZE];
+	SR_CALL_OR_EXIT( makeTempFileName(sortedNames[0], TEMP_PATH_SIZE) );
+	SR_CALL_OR_EXIT( makeTempFileName(sortedNames[1], TEMP_PATH_SIZE) );
+
+	int joinA, joinB;
+	SR_CALL_OR_EXIT( prepareJoinInput(fdA, sortedNames[0], fieldNo, bufferSize, &joinA) );
+	SR_CALL_OR_EXIT( prepareJoinInput(fdB, sortedNames[1], fieldNo, bufferSize, &joinB) );
+
+	SR_ErrorCode rv = mergeJoin(joinA, joinB, fieldNo, bufferSize, callback, context);
+
+	// Drop the sorted copies made for the join, if any
+	if (joinA != fdA)
+	{
+		SR_CALL_OR_EXIT( SR_CloseFile(joinA) );
+		removeFile(sortedNames[0]);
+	}
+	if (joinB != fdB)
+	{
+		SR_CALL_OR_EXIT( SR_CloseFile(joinB) );
+		removeFile(sortedNames[1]);
+	}
+
+	return rv;
+}
+
+typedef struct aggregateSink {
+	exportBuffer buffer;	// The CSV output
+	const sortMode *mode;
+} aggregateSink;
+
+// Utility Function:
+// Partial aggregates travel through the runs inside the records themselves,
+// in a field that is neither the key nor the id they are computed over
+static char * aggregateState(Record *record, const int fieldNo)
+{
+	return (fieldNo == 1) ? record->surname : record->name;
+}
+
+static long long getAggregate(const Record *record, const int fieldNo)
+{
+	long long value;
+	memcpy(&value, aggregateState((Record *) record, fieldNo), sizeof(long long));
+	return value;
+}
+
+static void setAggregate(Record *record, const int fieldNo, long long value)
+{
+	memcpy(aggregateState(record, fieldNo), &value, sizeof(long long));
+}
+
+// Utility Function:
+// Turns an input record into the partial aggregate of a group of one record
+static void prepareAggregate(Record *record, const sortMode *mode)
+{
+	setAggregate(record, mode->fieldNo, (mode->aggregate == SR_AGG_COUNT) ? 1 : record->id);
+}
+
+// Utility Function:
+// Combines the partial aggregate of "next" into the one of "last"
+static void absorbAggregate(Record *last, const Record *next, const sortMode *mode)
+{
+	long long a = getAggregate(last, mode->fieldNo), b = getAggregate(next, mode->fieldNo);
+
+	switch(mode->aggregate)
+	{
+		case SR_AGG_COUNT :
+		case SR_AGG_SUM :
+			a += b;
+			break;
+		case SR_AGG_MIN :
+			a = (b < a) ? b : a;
+			break;
+		default:
+			a = (b > a) ? b : a;
+			break;
+	}
+
+	setAggregate(last, mode->fieldNo, a);
+}
+
+// Utility Function:
+// Writes a finished group as a "key,value" line
+static SR_ErrorCode emitAggregate(const Record *record, void *sink)
+{
+	aggregateSink *aggregate = (aggregateSink *) sink;
+	int fieldNo = aggregate->mode->fieldNo;
+
+	SR_CALL_OR_EXIT( reserveExport(&aggregate->buffer, EXPORT_MAX_ROW) );
+
+	if (fieldNo == 0)
+		appendNumber(&aggregate->buffer, record->id);
+	else
+		appendCSVField(&aggregate->buffer, recordField(record, fieldNo), fieldSize(fieldNo));
+
+	aggregate->buffer.data[aggregate->buffer.used++] = ',';
+	appendNumber(&aggregate->buffer, getAggregate(record, fieldNo));
+	aggregate->buffer.data[aggregate->buffer.used++] = '\n';
+
+	return SR_OK;
+}
+
+SR_ErrorCode SR_SortedAggregate(
+	const char* input_filename,
+	int fieldNo,
+	int bufferSize,
+	SR_Aggregate agg,
+	const char* output_filename)
+{
+	static const char * fieldNames[] = { "id", "name", "surname", "city" };
+	static const char * aggregateNames[] = { "count", "sum", "min", "max" };
+
+	if (fieldNo < 0 || fieldNo > 3 || bufferSize < 3 || bufferSize > BF_BUFFER_SIZE ||
+	    agg < SR_AGG_COUNT || agg > SR_AGG_MAX)
+		return SR_ERROR;
+
+	int inputfd;
+	SR_CALL_OR_EXIT( SR_OpenFile(input_filename, &inputfd) );
+
+	sortMode mode;
+	initSortMode(&mode, fieldNo);
+	mode.prepare = prepareAggregate;
+	mode.fold = true;
+	mode.absorb = absorbAggregate;
+	mode.aggregate = agg;
+
+	aggregateSink sink;
+	sink.mode = &mode;
+	int outputFd = open(output_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	SR_ErrorCode rv = SR_OK;
+	if (outputFd < 0)
+	{
+		perror(output_filename);
+		rv = SR_ERROR;
+	}
+	else if ((rv = openExport(&sink.buffer, outputFd)) != SR_OK)
+	{
+		close(outputFd);
+		outputFd = -1;
+	}
+
+	if (rv == SR_OK)
+	{
+		sink.buffer.used = snprintf(sink.buffer.data, EXPORT_BUFFER_SIZE, "%s,%s\n", fieldNames[fieldNo], aggregateNames[agg]);
+
+		rv = sortFile(inputfd, output_filename, &mode, bufferSize, emitAggregate, &sink);
+
+		SR_ErrorCode closeCode = closeExport(&sink.buffer, rv == SR_OK);
+		if (rv == SR_OK)
+			rv = closeCode;
+	}
+
+	if (outputFd >= 0)
+		close(outputFd);
+
+	SR_CALL_OR_EXIT( SR_CloseFile(inputfd) );
+
+	return rv;
+}
@@ -1,81 +1,716 @@
-#include "sort_file.h"
-#include "bf.h"
+#define _GNU_SOURCE		// For fallocate
+#include "sort_file_internal.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+
+// The BF layer is not thread safe, so sorts running side by side
+// (see SR_RunSortJobs) take this lock around every BF call
+static pthread_mutex_t bfLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Block activity since the last SR_ResetStats, globally and per file,
+// updated under bfLock
+static SR_Stats blockStats;
+static SR_Stats fileStats[BF_MAX_OPEN_FILES];
+
+// Phases of the last sort run by the calling thread
+static __thread SR_SortStats sortStats;
+
+// The BF layer computes byte offsets in an int, so a BF file cannot grow
+// past SR_MAX_SEGMENT_BLOCKS blocks: larger files are split into segments,
+// each a BF file of its own. Segment 0 is the file itself, META included,
+// segment n > 0 is named "<fileName>.<n>", and block b of the file is
+// block b % segmentBlocks of segment b / segmentBlocks
+typedef struct fileSegments {
+	char *fileName;		// NULL unless the file was opened through openBlockFile
+	int segmentBlocks;	// Blocks of every segment but the last
+	int count;			// Segments of the file
+	int *segments;		// BF descriptor of every segment, -1 until it is opened
+} fileSegments;
+
+// Segments of every open file, by the descriptor of its segment 0,
+// accessed under bfLock
+static fileSegments segmentsOf[BF_MAX_OPEN_FILES];
+
+// BF files opened through openBFFile and not closed yet, accessed under bfLock
+static int openFiles = 0;
+
+// The BF layer closes a file even while some of its blocks are pinned, freeing
+// their frames, so closeIdleSegment needs the pins of every segment past the
+// first. Those are counted per BF descriptor, with the descriptor of every
+// frame they pinned to find it again when it is unpinned. Blocks of a first
+// segment, i.e. of every file that is not split, are not tracked
+typedef struct pinnedFrame {
+	char *data;			// NULL if the entry is free
+	int fileDesc;		// BF descriptor of the block in the frame
+	int pins;
+} pinnedFrame;
+
+static pinnedFrame pinnedFrames[BF_BUFFER_SIZE];
+static int pinsOf[BF_MAX_OPEN_FILES];
+static int trackedPins = 0;		// Sum of pinsOf, no frame is looked up while it is 0
+
+// Segment size of the files created from now on, see SR_SetSegmentBlocks
+static int newSegmentBlocks = SR_MAX_SEGMENT_BLOCKS;
 
-#define BF_CALL_OR_EXIT(call)	\
-{                           	\
-	BF_ErrorCode code = call; 	\
-	if(code != BF_OK) {       	\
-		BF_PrintError(code);    \
-		return SR_BF_ERROR;		\
-	}                         	\
+// Utility Function:
+// Returns the counters of the file fileDesc, or NULL if it is out of range
+static SR_Stats * statsOf(const int fileDesc)
+{
+	if (fileDesc < 0 || fileDesc >= BF_MAX_OPEN_FILES)
+		return NULL;
+	return &fileStats[fileDesc];
+}
+
+// Utility Function:
+// Counts a failed BF call on the file fileDesc
+static void countError(const int fileDesc, const BF_ErrorCode code)
+{
+	if (code < BF_OK || code > BF_ERROR)
+		return;
+
+	blockStats.errors[code]++;
+	SR_Stats *stats = statsOf(fileDesc);
+	if (stats != NULL)
+		stats->errors[code]++;
+}
+
+// Utility Function:
+// Counts a block that has just been pinned, of segment segmentDesc of the file fileDesc
+static void countPin(const int fileDesc, const int segmentDesc, BF_Block *block)
+{
+	blockStats.pinned++;
+	if (blockStats.pinned > blockStats.peakPinned)
+		blockStats.peakPinned = blockStats.pinned;
+
+	if (segmentDesc == fileDesc || segmentDesc < 0 || segmentDesc >= BF_MAX_OPEN_FILES)
+		return;
+
+	char *data = BF_Block_GetData(block);
+	pinnedFrame *entry = NULL;
+	for (int i = 0; i < BF_BUFFER_SIZE; i++)
+	{
+		if (pinnedFrames[i].data == data)
+		{
+			entry = &pinnedFrames[i];
+			break;
+		}
+		if (pinnedFrames[i].data == NULL && entry == NULL)
+			entry = &pinnedFrames[i];
+	}
+
+	// Every frame holds one block, so there is always a free entry
+	if (entry->data == NULL)
+	{
+		entry->data = data;
+		entry->fileDesc = segmentDesc;
+		entry->pins = 0;
+	}
+	entry->pins++;
+	pinsOf[segmentDesc]++;
+	trackedPins++;
+}
+
+// Utility Function:
+// Counts a block, with the frame data, that has just been unpinned
+static void countUnpin(const char *data)
+{
+	blockStats.pinned--;
+
+	for (int i = 0; trackedPins > 0 && i < BF_BUFFER_SIZE; i++)
+	{
+		if (pinnedFrames[i].data == data)
+		{
+			pinsOf[pinnedFrames[i].fileDesc]--;
+			trackedPins--;
+			if (--pinnedFrames[i].pins == 0)
+				pinnedFrames[i].data = NULL;
+			return;
+		}
+	}
+}
+
+// Utility Function:
+// Writes the name of segment "segment" of the file fileName into "name"
+// Returns false if it does not fit in "size" bytes
+static bool segmentName(const char *fileName, const int segment, char *name, const size_t size)
+{
+	int length = (segment == 0) ? snprintf(name, size, "%s", fileName)
+	                            : snprintf(name, size, "%s.%d", fileName, segment);
+
+	return (length >= 0 && (size_t) length < size);
+}
+
+// Utility Function:
+// Removes segments "first" on of the file fileName, up to the first one missing
+static void removeSegments(const char *fileName, const int first)
+{
+	char name[PATH_MAX];
+	for (int segment = first; ; segment++)
+	{
+		if (!segmentName(fileName, segment, name, sizeof(name)) || remove(name) != 0)
+			break;
+	}
+}
+
+// Utility Function:
+// Removes the file fileName, all of its segments included
+void removeFile(const char *fileName)
+{
+	removeSegments(fileName, 0);
+}
+
+// Utility Function:
+// Renames the file "from", all of its segments included, to "to", replacing
+// any file of that name. Returns 0 on success, or -1 if "from" cannot be
+// renamed, e.g. to another file system, in which case nothing is renamed
+static int renameFile(const char *from, const char *to)
+{
+	removeSegments(to, 1);
+	if (rename(from, to) != 0)
+		return -1;
+
+	char fromName[PATH_MAX], toName[PATH_MAX];
+	for (int segment = 1; ; segment++)
+	{
+		if (!segmentName(from, segment, fromName, sizeof(fromName)) ||
+		    !segmentName(to, segment, toName, sizeof(toName)) ||
+		    rename(fromName, toName) != 0)
+			break;
+	}
+
+	return 0;
+}
+
+// Utility Function:
+// Sets up the segments of the file fileName, just opened as fileDesc
+// The segment size comes from META; only a full segment 0 can have others after it
+// Called with bfLock held
+static BF_ErrorCode openSegments(const char *fileName, const int fileDesc)
+{
+	fileSegments *file = &segmentsOf[fileDesc];
+	file->segmentBlocks = SR_MAX_SEGMENT_BLOCKS;
+	file->count = 1;
+
+	int blocks;
+	BF_CALL_OR_RETURN(BF_GetBlockCounter(fileDesc, &blocks));
+	if (blocks > META)
+	{
+		BF_Block *block;
+		BF_Block_Init(&block);
+		BF_CALL_OR_RETURN(BF_GetBlock(fileDesc, META, block));
+
+		int segmentBlocks;
+		memcpy(&segmentBlocks, &BF_Block_GetData(block)[SEGMENT_BLOCKS], sizeof(int));
+		if (segmentBlocks > 0 && segmentBlocks <= SR_MAX_SEGMENT_BLOCKS)
+			file->segmentBlocks = segmentBlocks;
+
+		BF_CALL_OR_RETURN(BF_UnpinBlock(block));
+		BF_Block_Destroy(&block);
+	}
+
+	char name[PATH_MAX];
+	if (blocks == file->segmentBlocks)
+	{
+		while (segmentName(fileName, file->count, name, sizeof(name)) && access(name, F_OK) == 0)
+			file->count++;
+	}
+
+	file->fileName = strdup(fileName);
+	file->segments = malloc(file->count * sizeof(int));
+	if (file->fileName == NULL || file->segments == NULL)
+		return BF_ERROR;
+
+	file->segments[0] = fileDesc;
+	for (int i = 1; i < file->count; i++)
+		file->segments[i] = -1;
+
+	return BF_OK;
+}
+
+// Utility Function:
+// Closes a segment past segment 0 of any open file that has no block pinned,
+// to make room for another one. Returns false if there is none
+// Called with bfLock held
+static bool closeIdleSegment(void)
+{
+	for (int i = 0; i < BF_MAX_OPEN_FILES; i++)
+	{
+		fileSegments *file = &segmentsOf[i];
+		for (int segment = 1; file->fileName != NULL && segment < file->count; segment++)
+		{
+			int segmentDesc = file->segments[segment];
+			if (segmentDesc >= 0 && pinsOf[segmentDesc] == 0 && BF_CloseFile(segmentDesc) == BF_OK)
+			{
+				file->segments[segment] = -1;
+				openFiles--;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+// Utility Function:
+// Opens fileName in the BF layer, closing idle segments first while the open
+// files are at the limit of the BF layer
+// The BF layer leaks a system file descriptor on every open it refuses for
+// that limit, so room has to be made before the call rather than after it
+// Called with bfLock held
+static BF_ErrorCode openBFFile(const char *fileName, int *fileDesc)
+{
+	while (openFiles >= BF_MAX_OPEN_FILES && closeIdleSegment())
+		;
+
+	BF_CALL_OR_RETURN(BF_OpenFile(fileName, fileDesc));
+	openFiles++;
+
+	return BF_OK;
+}
+
+// Utility Function:
+// Returns in segmentDesc the BF descriptor of segment "segment" of the open
+// file fileDesc, opening it first if needed
+// Segments are opened as they are used, and closed again whenever the BF
+// layer runs out of open files, so only the segments in use count towards them
+// Called with bfLock held
+static BF_ErrorCode openSegment(const int fileDesc, const int segment, int *segmentDesc)
+{
+	fileSegments *file = &segmentsOf[fileDesc];
+	if (segment >= file->count)
+		return BF_INVALID_BLOCK_NUMBER_ERROR;
+
+	if (file->segments[segment] < 0)
+	{
+		char name[PATH_MAX];
+		if (!segmentName(file->fileName, segment, name, sizeof(name)))
+			return BF_ERROR;
+
+		BF_CALL_OR_RETURN(openBFFile(name, &file->segments[segment]));
+	}
+
+	*segmentDesc = file->segments[segment];
+
+	return BF_OK;
+}
+
+// Utility Function:
+// Appends a new, empty segment to the open file fileDesc
+// Called with bfLock held
+static BF_ErrorCode addSegment(const int fileDesc)
+{
+	fileSegments *file = &segmentsOf[fileDesc];
+
+	int *segments = realloc(file->segments, (file->count + 1) * sizeof(int));
+	if (segments == NULL)
+		return BF_ERROR;
+	file->segments = segments;
+
+	char name[PATH_MAX];
+	if (!segmentName(file->fileName, file->count, name, sizeof(name)))
+		return BF_ERROR;
+	BF_CALL_OR_RETURN(BF_CreateFile(name));
+	file->segments[file->count++] = -1;
+
+	return BF_OK;
+}
+
+// Utility Function:
+// Finds the segment of the open file fileDesc holding block blockNum,
+// returning its descriptor and the number of the block inside it
+// Files not opened through openBlockFile are a single segment
+// Called with bfLock held
+static BF_ErrorCode locateBlock(const int fileDesc, const long long blockNum, int *segmentDesc, int *segmentBlock)
+{
+	fileSegments *file = (fileDesc >= 0 && fileDesc < BF_MAX_OPEN_FILES) ? &segmentsOf[fileDesc] : NULL;
+	if (file == NULL || file->fileName == NULL)
+	{
+		if (blockNum > INT_MAX)
+			return BF_INVALID_BLOCK_NUMBER_ERROR;
+		*segmentDesc = fileDesc;
+		*segmentBlock = (int) blockNum;
+		return BF_OK;
+	}
+
+	if (blockNum < 0)
+		return BF_INVALID_BLOCK_NUMBER_ERROR;
+	*segmentBlock = (int) (blockNum % file->segmentBlocks);
+
+	return openSegment(fileDesc, (int) (blockNum / file->segmentBlocks), segmentDesc);
+}
+
+// The functions below stand in for the BF calls of the same name, taking
+// bfLock and keeping the counters of SR_GetStats up to date
+// Block numbers are those of the whole file, across its segments
+
+// A stale segment left by a file of the same name removed with remove()
+// would be taken for one of the new file, so those are removed first
+BF_ErrorCode createBlockFile(const char *fileName)
+{
+	pthread_mutex_lock(&bfLock);
+	BF_ErrorCode code = BF_CreateFile(fileName);
+	if (code == BF_OK)
+		removeSegments(fileName, 1);
+	pthread_mutex_unlock(&bfLock);
+
+	return code;
+}
+
+BF_ErrorCode openBlockFile(const char *fileName, int *fileDesc)
+{
+	pthread_mutex_lock(&bfLock);
+	BF_ErrorCode code = openBFFile(fileName, fileDesc);
+	if (code != BF_OK)
+		countError(-1, code);
+	else
+	{
+		// The descriptor may have been used by a file closed before
+		SR_Stats *stats = statsOf(*fileDesc);
+		if (stats != NULL)
+			memset(stats, 0, sizeof(SR_Stats));
+
+		code = openSegments(fileName, *fileDesc);
+		if (code != BF_OK)
+		{
+			countError(*fileDesc, code);
+			free(segmentsOf[*fileDesc].fileName);
+			free(segmentsOf[*fileDesc].segments);
+			memset(&segmentsOf[*fileDesc], 0, sizeof(fileSegments));
+			if (BF_CloseFile(*fileDesc) == BF_OK)
+				openFiles--;
+		}
+	}
+	pthread_mutex_unlock(&bfLock);
+
+	return code;
+}
+
+BF_ErrorCode closeBlockFile(const int fileDesc)
+{
+	pthread_mutex_lock(&bfLock);
+	BF_ErrorCode code = BF_OK;
+	fileSegments *file = (fileDesc >= 0 && fileDesc < BF_MAX_OPEN_FILES) ? &segmentsOf[fileDesc] : NULL;
+	if (file != NULL && file->fileName != NULL)
+	{
+		for (int i = 1; i < file->count && code == BF_OK; i++)
+		{
+			if (file->segments[i] >= 0 && (code = BF_CloseFile(file->segments[i])) == BF_OK)
+				openFiles--;
+		}
+
+		free(file->fileName);
+		free(file->segments);
+		memset(file, 0, sizeof(fileSegments));
+	}
+	if (code == BF_OK && (code = BF_CloseFile(fileDesc)) == BF_OK)
+		openFiles--;
+	pthread_mutex_unlock(&bfLock);
+
+	return code;
+}
+
+BF_ErrorCode getBlockCounter(const int fileDesc, long long *blocks)
+{
+	pthread_mutex_lock(&bfLock);
+	fileSegments *file = (fileDesc >= 0 && fileDesc < BF_MAX_OPEN_FILES) ? &segmentsOf[fileDesc] : NULL;
+	int last = (file != NULL && file->fileName != NULL) ? file->count - 1 : 0;
+
+	// Every segment before the last one is full
+	int lastDesc = fileDesc, lastBlocks = 0;
+	BF_ErrorCode code = (last > 0) ? openSegment(fileDesc, last, &lastDesc) : BF_OK;
+	if (code == BF_OK)
+		code = BF_GetBlockCounter(lastDesc, &lastBlocks);
+	if (code == BF_OK)
+		*blocks = (last > 0) ? (long long) last * file->segmentBlocks + lastBlocks : lastBlocks;
+	pthread_mutex_unlock(&bfLock);
+
+	return code;
+}
+
+BF_ErrorCode getBlock(const int fileDesc, const long long blockNum, BF_Block *block)
+{
+	pthread_mutex_lock(&bfLock);
+	int segmentDesc, segmentBlock;
+	BF_ErrorCode code = locateBlock(fileDesc, blockNum, &segmentDesc, &segmentBlock);
+	if (code == BF_OK)
+		code = BF_GetBlock(segmentDesc, segmentBlock, block);
+	if (code != BF_OK)
+		countError(fileDesc, code);
+	else
+	{
+		blockStats.pins++;
+		SR_Stats *stats = statsOf(fileDesc);
+		if (stats != NULL)
+			stats->pins++;
+		countPin(fileDesc, segmentDesc, block);
+	}
+	pthread_mutex_unlock(&bfLock);
+
+	return code;
+}
+
+// Blocks are appended to the last segment, or to a new one once that is full
+BF_ErrorCode allocateBlock(const int fileDesc, BF_Block *block)
+{
+	pthread_mutex_lock(&bfLock);
+	fileSegments *file = (fileDesc >= 0 && fileDesc < BF_MAX_OPEN_FILES) ? &segmentsOf[fileDesc] : NULL;
+	int segmentDesc = fileDesc, segmentBlocks = 0;
+	BF_ErrorCode code = BF_OK;
+	if (file != NULL && file->fileName != NULL)
+	{
+		code = openSegment(fileDesc, file->count - 1, &segmentDesc);
+		if (code == BF_OK)
+			code = BF_GetBlockCounter(segmentDesc, &segmentBlocks);
+		if (code == BF_OK && segmentBlocks >= file->segmentBlocks)
+		{
+			code = addSegment(fileDesc);
+			if (code == BF_OK)
+				code = openSegment(fileDesc, file->count - 1, &segmentDesc);
+		}
+	}
+	if (code == BF_OK)
+		code = BF_AllocateBlock(segmentDesc, block);
+	if (code != BF_OK)
+		countError(fileDesc, code);
+	else
+	{
+		blockStats.allocations++;
+		SR_Stats *stats = statsOf(fileDesc);
+		if (stats != NULL)
+			stats->allocations++;
+		countPin(fileDesc, segmentDesc, block);
+	}
+	pthread_mutex_unlock(&bfLock);
+
+	return code;
+}
+
+BF_ErrorCode unpinBlock(BF_Block *block)
+{
+	pthread_mutex_lock(&bfLock);
+	// The data of the frame is only known for sure before it is unpinned
+	char *data = BF_Block_GetData(block);
+	BF_ErrorCode code = BF_UnpinBlock(block);
+	if (code != BF_OK)
+		countError(-1, code);
+	else
+	{
+		blockStats.unpins++;
+		countUnpin(data);
+	}
+	pthread_mutex_unlock(&bfLock);
+
+	return code;
+}
+
+void setDirty(BF_Block *block)
+{
+	pthread_mutex_lock(&bfLock);
+	BF_Block_SetDirty(block);
+	blockStats.dirtied++;
+	pthread_mutex_unlock(&bfLock);
+}
+
+// The BF layer does not count pins, so a block pinned twice is unpinned by
+// the first unpin of either. Two cursors over the same file that can come
+// across the same block share a single pin of it instead, through the two
+// functions below, where "other" is the block the other cursor has pinned
+
+// Utility Function:
+// Pins block blockNum of fileDesc in *block, or borrows "other", if not NULL,
+// when it is the same block, otherNum
+BF_ErrorCode pinSharedBlock(const int fileDesc, const long long blockNum, BF_Block **block,
+                                   BF_Block *other, const long long otherNum)
+{
+	if (other != NULL && otherNum == blockNum)
+	{
+		*block = other;
+		return BF_OK;
+	}
+
+	BF_Block_Init(block);
+	return getBlock(fileDesc, blockNum, *block);
+}
+
+// Utility Function:
+// Lets go of *block, marking it dirty first if asked to
+// Its pin is left to the other cursor if that is still on the block
+BF_ErrorCode unpinSharedBlock(BF_Block **block, const bool dirty, BF_Block *other)
+{
+	if (dirty)
+		setDirty(*block);
+	if (*block != other)
+	{
+		BF_CALL_OR_RETURN(unpinBlock(*block));
+		BF_Block_Destroy(block);
+	}
+	*block = NULL;
+
+	return BF_OK;
+}
+
+void SR_ResetStats()
+{
+	pthread_mutex_lock(&bfLock);
+	int pinned = blockStats.pinned;
+
+	memset(&blockStats, 0, sizeof(SR_Stats));
+	memset(fileStats, 0, sizeof(fileStats));
+	memset(&sortStats, 0, sizeof(SR_SortStats));
+
+	blockStats.pinned = pinned;
+	blockStats.peakPinned = pinned;
+	pthread_mutex_unlock(&bfLock);
+}
+
+SR_ErrorCode SR_GetStats(int fileDesc, SR_Stats *stats)
+{
+	if (fileDesc != -1)
+	{
+		SR_Stats *counters = statsOf(fileDesc);
+		if (counters == NULL)
+			return SR_ERROR;
+
+		pthread_mutex_lock(&bfLock);
+		memcpy(stats, counters, sizeof(SR_Stats));
+		pthread_mutex_unlock(&bfLock);
+		return SR_OK;
+	}
+
+	pthread_mutex_lock(&bfLock);
+	memcpy(stats, &blockStats, sizeof(SR_Stats));
+	pthread_mutex_unlock(&bfLock);
+
+	return SR_OK;
 }
 
-#define SR_CALL_OR_EXIT(call)	\
-{								\
-	SR_ErrorCode code  = call;	\
-	if( code != SR_OK)			\
-	{							\
-		return code; 			\
-	}							\
-}								\
+SR_ErrorCode SR_GetSortStats(SR_SortStats *stats)
+{
+	memcpy(stats, &sortStats, sizeof(SR_SortStats));
+	return SR_OK;
+}
 
 // Utility Function:
 // Assumes the file has already been opened
 // Accesses the file's metadata block
 // Checks if its identifier corresponds to that of a sorted file
-static bool isSorted(const int fileDesc)
+bool isSorted(const int fileDesc)
 {
 	BF_Block * block;
 	BF_Block_Init(&block);
 
-	BF_CALL_OR_EXIT(BF_GetBlock(fileDesc, META, block));
+	BF_CALL_OR_EXIT(getBlock(fileDesc, META, block));
 	char * blockData = BF_Block_GetData(block);
 
 	bool rv = (blockData[IDENTIFIER] == SORTED);
-	BF_CALL_OR_EXIT(BF_UnpinBlock(block));
+	BF_CALL_OR_EXIT(unpinBlock(block));
+
+	BF_Block_Destroy(&block);
+
+	return rv;
+}
+
+// Utility Function:
+// Assumes the file has already been opened
+// Returns the field the file's records are known to be sorted on, or -1
+int sortedOn(const int fileDesc)
+{
+	BF_Block * block;
+	BF_Block_Init(&block);
+
+	BF_ErrorCode code = getBlock(fileDesc, META, block);
+	if (code != BF_OK)
+	{
+		BF_PrintError(code);
+		BF_Block_Destroy(&block);
+		return -1;
+	}
+	char * blockData = BF_Block_GetData(block);
+
+	int rv = blockData[SORTED_ON] - 1;
+	unpinBlock(block);
 
 	BF_Block_Destroy(&block);
 
 	return rv;
 }
 
+// Utility Function:
+// Records in the META block of an open file that its records are sorted on fieldNo
+static SR_ErrorCode setSortedOn(const int fileDesc, const int fieldNo)
+{
+	BF_Block * block;
+	BF_Block_Init(&block);
+
+	BF_CALL_OR_EXIT(getBlock(fileDesc, META, block));
+	char * blockData = BF_Block_GetData(block);
+
+	blockData[SORTED_ON] = (char) (fieldNo + 1);
+	blockData[PREFIX_ON] = 0;
+
+	setDirty(block);
+	BF_CALL_OR_EXIT(unpinBlock(block));
+
+	BF_Block_Destroy(&block);
+
+	return SR_OK;
+}
+
 SR_ErrorCode SR_Init() 
 {
+	SR_ResetStats();
   	return SR_OK;
 }
 
 SR_ErrorCode SR_CreateFile(const char *fileName) 
 {
-	BF_CALL_OR_EXIT(BF_CreateFile(fileName));
+	BF_CALL_OR_EXIT(createBlockFile(fileName));
 
 	int fileDesc;
 	BF_Block *block;
 	BF_Block_Init(&block);
 
-	BF_CALL_OR_EXIT(BF_OpenFile(fileName, &fileDesc));
-	BF_CALL_OR_EXIT(BF_AllocateBlock(fileDesc, block));
+	BF_CALL_OR_EXIT(openBlockFile(fileName, &fileDesc));
+	BF_CALL_OR_EXIT(allocateBlock(fileDesc, block));
 	char *data = BF_Block_GetData(block);
 
 	// Set the first byte of first block (metaBlock) to the character 's' 
 	data[IDENTIFIER] = SORTED;
+	// An empty file has no known order yet
+	data[SORTED_ON] = 0;
+	data[PREFIX_ON] = 0;
+	memcpy(&data[SEGMENT_BLOCKS], &newSegmentBlocks, sizeof(int));
 
-	BF_Block_SetDirty(block);
-	BF_CALL_OR_EXIT(BF_UnpinBlock(block));
+	setDirty(block);
+	BF_CALL_OR_EXIT(unpinBlock(block));
 	BF_Block_Destroy(&block);
-	BF_CALL_OR_EXIT(BF_CloseFile(fileDesc));
+	BF_CALL_OR_EXIT(closeBlockFile(fileDesc));
 
   	return SR_OK;
 }
 
+SR_ErrorCode SR_SetSegmentBlocks(int blocks)
+{
+	if (blocks < 0 || blocks > SR_MAX_SEGMENT_BLOCKS)
+		return SR_ERROR;
+
+	newSegmentBlocks = (blocks == 0) ? SR_MAX_SEGMENT_BLOCKS : blocks;
+
+	return SR_OK;
+}
+
 SR_ErrorCode SR_OpenFile(const char *fileName, int *fileDesc)
 {
-	BF_CALL_OR_EXIT(BF_OpenFile(fileName, fileDesc));
+	BF_CALL_OR_EXIT(openBlockFile(fileName, fileDesc));
 	if (!isSorted(*fileDesc))
 	{
-		BF_CALL_OR_EXIT(BF_Close(fileName, fileDesc));
+		BF_CALL_OR_EXIT(closeBlockFile(*fileDesc));
 		return SR_UNSORTED;
 	}
 
@@ -87,29 +722,67 @@ SR_ErrorCode SR_CloseFile(int fileDesc)
 	if (!isSorted(fileDesc))
 		return SR_UNSORTED;
 
-	BF_CALL_OR_EXIT(BF_CloseFile(fileDesc));
+	BF_CALL_OR_EXIT(closeBlockFile(fileDesc));
 
 	return SR_OK;
 }
 
 SR_ErrorCode SR_InsertEntry(int fileDesc,	Record record) 
 {
-	if (!isSorted(fileDesc)) 
-		return SR_UNSORTED;
-
 	BF_Block *block;
 	BF_Block_Init(&block);
 
-	int blocksNum;
-	BF_CALL_OR_EXIT(BF_GetBlockCounter(fileDesc, &blocksNum));
-	BF_CALL_OR_EXIT(BF_GetBlock(fileDesc, blocksNum - 1, block));
+	// Check the identifier and, since appending breaks any order the file had,
+	// forget the field it was sorted on, all with a single pin of META
+	BF_CALL_OR_EXIT(getBlock(fileDesc, META, block));
+	char *meta = BF_Block_GetData(block);
+	if (meta[IDENTIFIER] != SORTED)
+	{
+		BF_CALL_OR_EXIT(unpinBlock(block));
+		BF_Block_Destroy(&block);
+		return SR_UNSORTED;
+	}
+	if (meta[SORTED_ON] != 0)
+	{
+		// The records so far stay a sorted prefix, which SR_Resort can build on
+		long long prefixBlock;
+		int prefixSlot;
+		BF_CALL_OR_EXIT(getBlockCounter(fileDesc, &prefixBlock));
+		if (prefixBlock == 1)
+			prefixSlot = 0;
+		else
+		{
+			BF_Block *last;
+			BF_Block_Init(&last);
+			BF_CALL_OR_EXIT(getBlock(fileDesc, prefixBlock - 1, last));
+			prefixSlot = *(int *) &BF_Block_GetData(last)[RECORDS];
+			BF_CALL_OR_EXIT(unpinBlock(last));
+			BF_Block_Destroy(&last);
+
+			if (prefixSlot < (int) MAXRECORDS)
+				prefixBlock--;
+			else
+				prefixSlot = 0;
+		}
+
+		meta[PREFIX_ON] = meta[SORTED_ON];
+		memcpy(&meta[PREFIX_BLOCK], &prefixBlock, sizeof(long long));
+		memcpy(&meta[PREFIX_SLOT], &prefixSlot, sizeof(int));
+		meta[SORTED_ON] = 0;
+		setDirty(block);
+	}
+	BF_CALL_OR_EXIT(unpinBlock(block));
+
+	long long blocksNum;
+	BF_CALL_OR_EXIT(getBlockCounter(fileDesc, &blocksNum));
+	BF_CALL_OR_EXIT(getBlock(fileDesc, blocksNum - 1, block));
 	char *data = BF_Block_GetData(block);
 
 	// If file has only one black (the metaBlock) OR block is full get a new one and write
-	if(blocksNum == 1 || (int)data[RECORDS] == MAXRECORDS) {
+	if(blocksNum == 1 || *(int *)&data[RECORDS] == MAXRECORDS) {
 		BF_Block *newBlock;
 		BF_Block_Init(&newBlock);
-		BF_CALL_OR_EXIT(BF_AllocateBlock(fileDesc, newBlock));
+		BF_CALL_OR_EXIT(allocateBlock(fileDesc, newBlock));
 		data = BF_Block_GetData(newBlock);
 
 		int one = 1;
@@ -117,14 +790,14 @@ SR_ErrorCode SR_InsertEntry(int fileDesc,	Record record)
 
 		memcpy((Record *)&data[RECORD(0)], &record, sizeof(Record));
 
-		BF_Block_SetDirty(newBlock);
-		BF_CALL_OR_EXIT(BF_UnpinBlock(newBlock));
+		setDirty(newBlock);
+		BF_CALL_OR_EXIT(unpinBlock(newBlock));
 		BF_Block_Destroy(&newBlock);
 	}
 	// Else just write
 	else if (blocksNum != 1) {
 
-		int records = (int)data[RECORDS];
+		int records = *(int *)&data[RECORDS];
 		
 		// data[RECORD(records)] is the offset where the last record written stops. So write there
 		memcpy((Record *)&data[RECORD(records)], &record, sizeof(Record));
@@ -132,10 +805,10 @@ SR_ErrorCode SR_InsertEntry(int fileDesc,	Record record)
 		records += 1;
 		memcpy((int *)&data[RECORDS], &records, sizeof(int));
 
-		BF_Block_SetDirty(block);
+		setDirty(block);
 	}
 
-	BF_CALL_OR_EXIT( BF_UnpinBlock(block) );
+	BF_CALL_OR_EXIT( unpinBlock(block) );
 	BF_Block_Destroy(&block);
 
   	return SR_OK;
@@ -145,7 +818,7 @@ SR_ErrorCode SR_InsertEntry(int fileDesc,	Record record)
 // Used in comparing two records ("ra" and "rb")
 // according to a field specified by fieldNo
 // Returns true if "ra" is "lesser" than "rb"
-static bool compareRecord(const Record * const ra, const Record * const rb, const int fieldNo)
+bool compareRecord(const Record * const ra, const Record * const rb, const int fieldNo)
 {
 	switch(fieldNo)
 	{
@@ -161,15 +834,159 @@ static bool compareRecord(const Record * const ra, const Record * const rb, cons
 }
 
 // Utility Function:
-// Used in swapping two records
-// Record "ra" and "rb" should not be overlapping
-static void swapRecord(Record * const ra, Record * const rb)
+// Returns a pointer to the field of "record" specified by fieldNo
+char * recordField(const Record *record, const int fieldNo)
 {
-	if (ra != rb)
+	switch(fieldNo)
 	{
-		Record rac;
-		
-		memcpy((void *) &rac, (void *)   ra, sizeof(Record));
+		case 0 :
+			return (char *) &record->id;
+		case 1 :
+			return (char *) record->name;
+		case 2 :
+			return (char *) record->surname;
+		default:
+			return (char *) record->city;
+	}
+}
+
+// Utility Function:
+// Returns the size in bytes of the field specified by fieldNo
+int fieldSize(const int fieldNo)
+{
+	switch(fieldNo)
+	{
+		case 0 :
+			return sizeof(((Record *) 0)->id);
+		case 1 :
+			return sizeof(((Record *) 0)->name);
+		case 2 :
+			return sizeof(((Record *) 0)->surname);
+		default:
+			return sizeof(((Record *) 0)->city);
+	}
+}
+
+// Directory temp files are created in, see SR_SetTempDirectory
+static char tempDirectory[TEMP_PATH_SIZE] = ".";
+
+// Numbers the temp files of this process
+static unsigned int tempCounter = 0;
+
+// Utility Function:
+// Writes to "name" a temp file name no other sort uses, in this process or another
+SR_ErrorCode makeTempFileName(char *name, size_t size)
+{
+	unsigned int id = __sync_fetch_and_add(&tempCounter, 1);
+
+	if (snprintf(name, size, "%s/sort_%ld_%u.db", tempDirectory, (long) getpid(), id) >= (int) size)
+		return SR_ERROR;
+
+	return SR_OK;
+}
+
+SR_ErrorCode SR_SetTempDirectory(const char *path)
+{
+	if (path == NULL || path[0] == '\0')
+		path = ".";
+
+	if (strlen(path) >= TEMP_PATH_SIZE - 64 || access(path, W_OK | X_OK) != 0)
+		return SR_ERROR;
+
+	strcpy(tempDirectory, path);
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Returns the frames the next chunk or merge of a sort may pin
+// Without a pool that is always bufferSize; with one, the sort's fair share
+// of the pool, or what is left of it but never less than 3
+static int acquireFrames(framePool *pool, const int bufferSize)
+{
+	if (pool == NULL)
+		return bufferSize;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (pool->free < 3)
+		pthread_cond_wait(&pool->released, &pool->lock);
+
+	int share = pool->total / (pool->active > 0 ? pool->active : 1);
+	if (share < 3)
+		share = 3;
+
+	int frames = (share < pool->free) ? share : pool->free;
+	pool->free -= frames;
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return frames;
+}
+
+// Utility Function:
+// Gives back the frames taken by acquireFrames
+static void releaseFrames(framePool *pool, const int frames)
+{
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->free += frames;
+	pthread_cond_broadcast(&pool->released);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// Utility Function:
+// Sets up a plain sort on fieldNo, without any of the optional behaviours
+void initSortMode(sortMode *mode, const int fieldNo)
+{
+	memset(mode, 0, sizeof(sortMode));
+	mode->fieldNo = fieldNo;
+}
+
+// Utility Function:
+// Returns true if "ra" is "lesser" than "rb" according to the sort mode
+static bool lessRecord(const Record * const ra, const Record * const rb, const sortMode *mode)
+{
+	if (!mode->wholeRecord)
+		return compareRecord(ra, rb, mode->fieldNo);
+
+	if (compareRecord(ra, rb, mode->fieldNo))
+		return true;
+	if (compareRecord(rb, ra, mode->fieldNo))
+		return false;
+
+	// Same key, so the remaining fields decide, in declaration order
+	if (ra->id != rb->id)
+		return (ra->id < rb->id);
+
+	int cmp = strncmp(ra->name, rb->name, sizeof(ra->name));
+	if (cmp == 0)
+		cmp = strncmp(ra->surname, rb->surname, sizeof(ra->surname));
+	if (cmp == 0)
+		cmp = strncmp(ra->city, rb->city, sizeof(ra->city));
+
+	return (cmp < 0);
+}
+
+// Utility Function:
+// Returns true if neither record is "lesser" than the other
+static bool sameKey(const Record * const ra, const Record * const rb, const sortMode *mode)
+{
+	return !lessRecord(ra, rb, mode) && !lessRecord(rb, ra, mode);
+}
+
+// Utility Function:
+// Used in swapping two records
+// Record "ra" and "rb" should not be overlapping
+static void swapRecord(Record * const ra, Record * const rb)
+{
+	if (ra != rb)
+	{
+		Record rac;
+		
+		memcpy((void *) &rac, (void *)   ra, sizeof(Record));
 		memcpy((void *)   ra, (void *)   rb, sizeof(Record));
 		memcpy((void *)   rb, (void *) &rac, sizeof(Record));
 	}
@@ -188,7 +1005,7 @@ static Record * getRecord(char * const blockData[], const int index)
 // Utility Function:
 // Treat the chunk of blocks as an one dimensional array
 // and partition it based on the "Lomuto partition scheme"
-static int partition(char * const blockData[], const int lo, const int hi, const int fieldNo)
+static int partition(char * const blockData[], const int lo, const int hi, const sortMode *mode)
 {	
 	Record * pivot = getRecord(blockData, hi), * recordJ, * recordI;
 	
@@ -196,7 +1013,7 @@ static int partition(char * const blockData[], const int lo, const int hi, const
 	for (int j = lo; j <= hi - 1; j++)
 	{
 		recordJ = getRecord(blockData, j);
-		if (compareRecord(recordJ, pivot, fieldNo))
+		if (lessRecord(recordJ, pivot, mode))
 		{
 			recordI = getRecord(blockData, ++i);
 			swapRecord(recordI, recordJ);
@@ -205,7 +1022,7 @@ static int partition(char * const blockData[], const int lo, const int hi, const
 
 	recordJ = getRecord(blockData, hi);
 	recordI = getRecord(blockData, i + 1);
-	if (compareRecord(recordJ, recordI, fieldNo))
+	if (lessRecord(recordJ, recordI, mode))
 		swapRecord(recordJ, recordI);
 
 	return i + 1;
@@ -214,250 +1031,746 @@ static int partition(char * const blockData[], const int lo, const int hi, const
 // Utility Function:
 // Used by "external sort" at "Phase 0"
 // in sorting the original chunks of blocks
-static void quickSort(char * const blockData[], const int lo, const int hi, const int fieldNo)
+static void quickSort(char * const blockData[], const int lo, const int hi, const sortMode *mode)
 {
 	if (lo < hi)
 	{
-		int piv = partition(blockData, lo, hi, fieldNo);
+		int piv = partition(blockData, lo, hi, mode);
 
-		quickSort(blockData, lo    , piv - 1, fieldNo);
-		quickSort(blockData, piv + 1, hi    , fieldNo);
+		quickSort(blockData, lo    , piv - 1, mode);
+		quickSort(blockData, piv + 1, hi    , mode);
 	}
 }
 
-typedef struct mergeBlock{
-	int endCounter;		  // Counter of first block of the next team
-	int blockCounter;  	// Counter of block inside file
-	int iterator;		    // Records iterator inside block (where we write/read)
-	BF_Block *block;	  // Current block
-	char *data;			    // Data of current block
-}mergeBlock;
+// A sorted run: "blocks" consecutive blocks of a temp file starting at "startBlock"
+// Only the last block of a run may be partially filled
+typedef struct sortRun {
+	long long startBlock;
+	long long blocks;
+	long long records;
+	int pass;		// Longest chain of merges the run came out of, 0 for Phase Zero
+} sortRun;
+
+// The blocks of the temp file of a sort, recycled from pass to pass
+// The BF layer can only append blocks, so the free ones are tracked here:
+// a merge writes its run over free blocks of runs already merged, and
+// appends to the file only when no free extent is large enough
+typedef struct tempSpace {
+	int fileDesc;
+	long long fileBlocks;	// Blocks of the file, META included
+	long long end;			// Every block from here on is free, none before it is in "extents"
+	sortRun *extents;	// Free extents, ordered by start block and never adjacent
+	int extentCount;
+	int capacity;
+} tempSpace;
+
+static SR_ErrorCode openTempSpace(tempSpace *space, int fileDesc, int capacity)
+{
+	space->fileDesc = fileDesc;
+	BF_CALL_OR_EXIT(getBlockCounter(fileDesc, &space->fileBlocks));
+	space->end = space->fileBlocks;
+	space->extentCount = 0;
+	space->capacity = capacity;
+	space->extents = malloc(capacity * sizeof(sortRun));
+
+	return (space->extents != NULL) ? SR_OK : SR_ERROR;
+}
 
-static SR_ErrorCode initMergeArray(int fileDesc, mergeBlock *blockArray, int bufferSize, int startIndex, int maxBlocks) {
+// Utility Function:
+// Returns the first block of "blocks" consecutive free blocks, taken out of the free space
+// The first free extent large enough is used, otherwise the space past the end
+static long long allocateExtent(tempSpace *space, long long blocks)
+{
+	for (int i = 0; i < space->extentCount; i++) {
+		sortRun *extent = &space->extents[i];
+		if (extent->blocks < blocks)
+			continue;
 
-	int allBlocks;
-	BF_CALL_OR_EXIT(BF_GetBlockCounter(fileDesc, &allBlocks));
+		long long start = extent->startBlock;
+		extent->startBlock += blocks;
+		extent->blocks -= blocks;
+		if (extent->blocks == 0) {
+			memmove(extent, extent + 1, (space->extentCount - i - 1) * sizeof(sortRun));
+			space->extentCount--;
+		}
+		return start;
+	}
 
-	// Initialization of array
+	long long start = space->end;
+	space->end += blocks;
+	return start;
+}
 
-	// StartIndex is the first block in all block "teams"
-	// Then, index increases by size of team (maxBlocks) so we start from the next team
-	int index = startIndex;
-	int i;
-	for (i = 0; i < bufferSize - 1; i++) {
-		// If current index (team's first block) is greater than all the blocks initialize to "invalid" 
-		if (index >= allBlocks) {
-			blockArray[i].iterator = -1;
-			blockArray[i].blockCounter = -1;
-			blockArray[i].data = NULL;
-			blockArray[i].block = NULL;
-			continue;
+// Utility Function:
+// Gives "blocks" blocks starting at "start" back to the free space
+static SR_ErrorCode freeExtent(tempSpace *space, long long start, long long blocks)
+{
+	if (blocks <= 0)
+		return SR_OK;
+
+	// Find where the extent goes, then merge it with its neighbours
+	int i = 0;
+	while (i < space->extentCount && space->extents[i].startBlock < start)
+		i++;
+
+	bool joinsPrevious = (i > 0 &&
+		space->extents[i - 1].startBlock + space->extents[i - 1].blocks == start);
+	bool joinsNext = (i < space->extentCount && start + blocks == space->extents[i].startBlock);
+
+	if (joinsPrevious && joinsNext) {
+		space->extents[i - 1].blocks += blocks + space->extents[i].blocks;
+		memmove(&space->extents[i], &space->extents[i + 1], (space->extentCount - i - 1) * sizeof(sortRun));
+		space->extentCount--;
+		i--;
+	}
+	else if (joinsPrevious) {
+		space->extents[--i].blocks += blocks;
+	}
+	else if (joinsNext) {
+		space->extents[i].startBlock = start;
+		space->extents[i].blocks += blocks;
+	}
+	else {
+		if (space->extentCount == space->capacity) {
+			sortRun *extents = realloc(space->extents, 2 * space->capacity * sizeof(sortRun));
+			if (extents == NULL)
+				return SR_ERROR;
+			space->extents = extents;
+			space->capacity *= 2;
 		}
-		// Else get first block of team for each team
-		BF_Block *block;
-		BF_Block_Init(&block);
-		BF_CALL_OR_EXIT(BF_GetBlock(fileDesc, index, block));
-		blockArray[i].data = BF_Block_GetData(block);
-		blockArray[i].block = block;
-		blockArray[i].iterator = 0;
-		blockArray[i].blockCounter = index;
-
-		// This check is only for the LAST team of blocks
-		// Which MAY have less than maxBlocks
-		// If so set the end counter to the end of last block which is allBlocks
-		if (index + maxBlocks >= allBlocks)
-			blockArray[i].endCounter = allBlocks;
-		// Else set it to the start of next team
-		else
-			blockArray[i].endCounter = index + maxBlocks;
-		index += maxBlocks;
+		memmove(&space->extents[i + 1], &space->extents[i], (space->extentCount - i) * sizeof(sortRun));
+		space->extents[i].startBlock = start;
+		space->extents[i].blocks = blocks;
+		space->extentCount++;
+	}
+
+	// An extent reaching the end is part of the free space past it
+	sortRun *last = &space->extents[space->extentCount - 1];
+	if (last->startBlock + last->blocks == space->end) {
+		space->end = last->startBlock;
+		space->extentCount--;
+	}
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Asks the file system to reserve room for "blocks" blocks of the file fileName,
+// without changing its size, so that the blocks appended later are laid out in
+// one piece. Only a hint, where fallocate is not available nothing is done
+static void preallocateFile(const char *fileName, long long blocks)
+{
+#ifdef FALLOC_FL_KEEP_SIZE
+	int fd = open(fileName, O_WRONLY);
+	if (fd < 0)
+		return;
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, blocks * BF_BLOCK_SIZE) != 0)
+		errno = 0;
+	close(fd);
+#else
+	(void) fileName;
+	(void) blocks;
+#endif
+}
+
+// Compressed run blocks, written to the temp file when SR_SetTempCompression is on
+// A block keeps its record count at data[RECORDS], followed by its records,
+// each coded against the record before it, or against an all-zero record
+// for the first one of the block, so that every block decodes on its own:
+//   the id as the zigzag varint of its difference from the previous id
+//   then every other field (the padding after the last one included) as
+//   one byte with the length of the prefix it shares with the previous
+//   record, one byte with the number of literal bytes that follow it, and
+//   those bytes, the rest of the field being zeros
+// Sorted runs share long prefixes on the key and zero padding on every
+// string, so most records take a fraction of their 60 bytes
+#define CODED_FIELDS	(3)
+#define CODED_MAX_SIZE	(5 + 2 * CODED_FIELDS + sizeof(Record) - offsetof(Record, name))
+
+// Records a compressed block always has room for
+#define CODED_MIN_RECORDS	( (BF_BLOCK_SIZE - sizeof(int)) / CODED_MAX_SIZE )
+
+static const size_t codedOffset[CODED_FIELDS + 1] = {
+	offsetof(Record, name), offsetof(Record, surname), offsetof(Record, city), sizeof(Record)
+};
+
+// Whether the sorts started from now on compress their runs
+static bool tempCompression = false;
+
+SR_ErrorCode SR_SetTempCompression(bool enabled)
+{
+	tempCompression = enabled;
+	return SR_OK;
+}
+
+// Utility Function:
+// Codes "record" against "previous" into "out", returning the bytes written
+static int encodeRecord(const Record *record, const Record *previous, unsigned char *out)
+{
+	int length = 0;
+
+	long long delta = (long long) record->id - previous->id;
+	unsigned long long zigzag = ((unsigned long long) delta << 1) ^ (unsigned long long) (delta >> 63);
+	while (zigzag >= 0x80) {
+		out[length++] = (unsigned char) (zigzag | 0x80);
+		zigzag >>= 7;
+	}
+	out[length++] = (unsigned char) zigzag;
+
+	const unsigned char *bytes = (const unsigned char *) record;
+	const unsigned char *before = (const unsigned char *) previous;
+
+	for (int f = 0; f < CODED_FIELDS; f++) {
+		int start = codedOffset[f], size = codedOffset[f + 1] - start;
+
+		int prefix = 0;
+		while (prefix < size && bytes[start + prefix] == before[start + prefix])
+			prefix++;
+
+		int used = size;
+		while (used > 0 && bytes[start + used - 1] == 0)
+			used--;
+
+		int literals = (used > prefix) ? used - prefix : 0;
+		out[length++] = (unsigned char) prefix;
+		out[length++] = (unsigned char) literals;
+		memcpy(&out[length], &bytes[start + prefix], literals);
+		length += literals;
+	}
+
+	return length;
+}
+
+// Utility Function:
+// Decodes a record coded against "previous" into "record", which may be "previous"
+// itself, returning the bytes read
+static int decodeRecord(const unsigned char *in, const Record *previous, Record *record)
+{
+	int length = 0, shift = 0;
+
+	unsigned long long zigzag = 0;
+	do {
+		zigzag |= (unsigned long long) (in[length] & 0x7f) << shift;
+		shift += 7;
+	} while (in[length++] & 0x80);
+	long long delta = (long long) (zigzag >> 1) ^ -(long long) (zigzag & 1);
+	int id = (int) (previous->id + delta);
+
+	unsigned char *bytes = (unsigned char *) record;
+	const unsigned char *before = (const unsigned char *) previous;
+
+	for (int f = 0; f < CODED_FIELDS; f++) {
+		int start = codedOffset[f], size = codedOffset[f + 1] - start;
+		int prefix = in[length++];
+		int literals = in[length++];
+
+		if (bytes != before)
+			memcpy(&bytes[start], &before[start], prefix);
+		memcpy(&bytes[start + prefix], &in[length], literals);
+		memset(&bytes[start + prefix + literals], 0, size - prefix - literals);
+		length += literals;
+	}
+	record->id = id;
+
+	return length;
+}
+
+typedef struct runWriter {
+	int fileDesc;		// File the run is written to
+	BF_Block *block;	// Current block, NULL until the first record arrives
+	char *data;			// Data of current block
+	int records;		// Records written to current block
+	long long blocks;	// Blocks written to the run so far
+	long long written;	// Records written to the run so far
+	Record pending;		// Last record, held back while records with the same key may follow
+	bool hasPending;
+	const sortMode *mode;
+
+	// If set, the run is written to the blocks of "space" from nextBlock on,
+	// instead of being appended to the file
+	tempSpace *space;
+	long long nextBlock;
+
+	// If set, blocks are written in the compressed format
+	bool compressed;
+	int used;			// Bytes of the current compressed block taken
+	Record previous;	// Last record written to the current compressed block
+
+	// If set, records are handed to emit instead of being written to blocks
+	SR_ErrorCode (*emit)(const Record *record, void *sink);
+	void *sink;
+} runWriter;
+
+static void openRunWriter(runWriter *writer, int fileDesc, const sortMode *mode)
+{
+	writer->fileDesc = fileDesc;
+	writer->block = NULL;
+	writer->data = NULL;
+	writer->records = 0;
+	writer->blocks = 0;
+	writer->written = 0;
+	writer->hasPending = false;
+	writer->mode = mode;
+	writer->space = NULL;
+	writer->nextBlock = 0;
+	writer->compressed = false;
+	writer->emit = NULL;
+	writer->sink = NULL;
+}
+
+// Utility Function:
+// Finishes the current block of the writer
+static SR_ErrorCode closeRunBlock(runWriter *writer)
+{
+	memcpy((int *)&writer->data[RECORDS], &writer->records, sizeof(int));
+	setDirty(writer->block);
+	BF_CALL_OR_EXIT(unpinBlock(writer->block));
+	BF_Block_Destroy(&writer->block);
+	writer->block = NULL;
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Gets the next block of the run, overwritten or appended
+static SR_ErrorCode openRunBlock(runWriter *writer)
+{
+	BF_Block_Init(&writer->block);
+
+	tempSpace *space = writer->space;
+	if (space != NULL && writer->nextBlock < space->fileBlocks) {
+		// A free block of the temp file, its old contents are overwritten
+		BF_CALL_OR_EXIT(getBlock(writer->fileDesc, writer->nextBlock, writer->block));
+	}
+	else {
+		BF_CALL_OR_EXIT(allocateBlock(writer->fileDesc, writer->block));
+		if (space != NULL)
+			space->fileBlocks++;
+	}
+	writer->nextBlock++;
+
+	writer->data = BF_Block_GetData(writer->block);
+	writer->records = 0;
+	writer->blocks++;
+
+	// A compressed block starts over from an all-zero record
+	writer->used = RECORD(0);
+	memset(&writer->previous, 0, sizeof(Record));
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Writes a record at the end of the run, getting a new block when the current one is full
+static SR_ErrorCode appendRun(runWriter *writer, const Record *record)
+{
+	writer->written++;
+
+	if (writer->emit != NULL)
+		return writer->emit(record, writer->sink);
+
+	if (writer->compressed) {
+		unsigned char coded[CODED_MAX_SIZE];
+		int length = 0;
+
+		if (writer->block != NULL)
+			length = encodeRecord(record, &writer->previous, coded);
+
+		if (writer->block == NULL || writer->used + length > BF_BLOCK_SIZE) {
+			if (writer->block != NULL)
+				SR_CALL_OR_EXIT( closeRunBlock(writer) );
+			SR_CALL_OR_EXIT( openRunBlock(writer) );
+			length = encodeRecord(record, &writer->previous, coded);
+		}
+
+		memcpy(&writer->data[writer->used], coded, length);
+		writer->used += length;
+		writer->records++;
+		memcpy(&writer->previous, record, sizeof(Record));
+
+		return SR_OK;
+	}
+
+	if (writer->block != NULL && writer->records >= (int) MAXRECORDS)
+		SR_CALL_OR_EXIT( closeRunBlock(writer) );
+
+	if (writer->block == NULL)
+		SR_CALL_OR_EXIT( openRunBlock(writer) );
+
+	memcpy(&writer->data[RECORD(writer->records)], record, sizeof(Record));
+	writer->records++;
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Returns true once the run has as many records as the sort mode allows
+static bool runFull(const runWriter *writer)
+{
+	return (writer->mode->limit > 0 && writer->written >= writer->mode->limit);
+}
+
+// Utility Function:
+// Adds a record to the run, in sorted order
+// If the sort mode folds records with the same key, the last record
+// is held back until one with a different key shows up
+static SR_ErrorCode writeRun(runWriter *writer, const Record *record)
+{
+	const sortMode *mode = writer->mode;
+
+	if (runFull(writer))
+		return SR_OK;
+
+	if (!mode->fold)
+		return appendRun(writer, record);
+
+	if (writer->hasPending && sameKey(&writer->pending, record, mode))
+	{
+		if (mode->absorb != NULL)
+			mode->absorb(&writer->pending, record, mode);
+		return SR_OK;
+	}
+
+	if (writer->hasPending)
+		SR_CALL_OR_EXIT( appendRun(writer, &writer->pending) );
+
+	memcpy(&writer->pending, record, sizeof(Record));
+	writer->hasPending = true;
+
+	return SR_OK;
+}
+
+static SR_ErrorCode closeRunWriter(runWriter *writer)
+{
+	if (writer->hasPending)
+	{
+		SR_CALL_OR_EXIT( appendRun(writer, &writer->pending) );
+		writer->hasPending = false;
 	}
 
+	if (writer->block != NULL)
+		SR_CALL_OR_EXIT( closeRunBlock(writer) );
+
 	return SR_OK;
 }
 
+typedef struct mergeBlock{
+	long long endCounter;		// Counter of first block of the next run
+	long long blockCounter;		// Counter of block inside file
+	int iterator;		    // Records iterator inside block (where we write/read)
+	BF_Block *block;	  // Current block
+	char *data;			    // Data of current block
+	bool compressed;	  // Whether the blocks of the run are compressed
+	int offset;			    // Byte offset of the next coded record in the block
+	Record decoded;		  // Current record of a compressed block
+	const Record *record;	// Current record of the run
+}mergeBlock;
+
+// Utility Function:
+// Points a valid merge block at the record under its iterator, decoding it if compressed
+static void loadMergeRecord(mergeBlock *mergeBlock) {
+	if (!mergeBlock->compressed) {
+		mergeBlock->record = (const Record *) &mergeBlock->data[RECORD(mergeBlock->iterator)];
+		return;
+	}
+
+	// A compressed block is decoded one record at a time, from an all-zero record on
+	if (mergeBlock->iterator == 0) {
+		memset(&mergeBlock->decoded, 0, sizeof(Record));
+		mergeBlock->offset = RECORD(0);
+	}
+	mergeBlock->offset += decodeRecord((const unsigned char *) &mergeBlock->data[mergeBlock->offset],
+	                                   &mergeBlock->decoded, &mergeBlock->decoded);
+	mergeBlock->record = &mergeBlock->decoded;
+}
+
+// Utility Function:
+// Moves a merge block past its exhausted blocks, pinning the next block of its run
+// Once the whole run has been read the merge block is set to "invalid"
 static SR_ErrorCode getNewBlock(int fileDesc, mergeBlock *blockArray, int minIndex) {
 	// If we went through whole block get a new one
-	if (blockArray[minIndex].iterator >= *(int *)&blockArray[minIndex].data[RECORDS]) {
-		// If there are more blocks to go through in this index
+	while (blockArray[minIndex].iterator >= *(int *)&blockArray[minIndex].data[RECORDS]) {
+		// If there are more blocks to go through in this run
 		if (blockArray[minIndex].blockCounter < blockArray[minIndex].endCounter - 1) {
-			BF_CALL_OR_EXIT( BF_UnpinBlock(blockArray[minIndex].block) );
-			int index = blockArray[minIndex].blockCounter + 1;
-			BF_CALL_OR_EXIT(BF_GetBlock(fileDesc, index, blockArray[minIndex].block));
+			BF_CALL_OR_EXIT( unpinBlock(blockArray[minIndex].block) );
+			long long index = blockArray[minIndex].blockCounter + 1;
+			BF_CALL_OR_EXIT(getBlock(fileDesc, index, blockArray[minIndex].block));
 			blockArray[minIndex].data = BF_Block_GetData(blockArray[minIndex].block);
 			blockArray[minIndex].iterator = 0;
 			blockArray[minIndex].blockCounter++;
 		}
 		// Else "delete" mergeblock, initialize it to "invalid"
 		else {
-			BF_CALL_OR_EXIT( BF_UnpinBlock(blockArray[minIndex].block) );
+			BF_CALL_OR_EXIT( unpinBlock(blockArray[minIndex].block) );
 			BF_Block_Destroy(&blockArray[minIndex].block);
 			blockArray[minIndex].iterator = -1;
 			blockArray[minIndex].blockCounter = -1;
 			blockArray[minIndex].data = NULL;
 			blockArray[minIndex].block = NULL;
+			blockArray[minIndex].record = NULL;
+			return SR_OK;
 		}
   	}
+	loadMergeRecord(&blockArray[minIndex]);
  	return SR_OK;
 }
 
-static int getNewResultBlock(int newfileDesc, mergeBlock *result) {
-	// If result block filled write it and get a new one
-	if ((int)result->data[RECORDS] >= MAXRECORDS) {
-		BF_Block_SetDirty(result->block);
-		BF_CALL_OR_EXIT(BF_UnpinBlock(result->block));
-		BF_Block_Destroy(&(result->block));
+static SR_ErrorCode initMergeArray(int fileDesc, mergeBlock *blockArray, const sortRun *runs, int runCount, bool compressed) {
+
+	// Get the first block of each run
+	for (int i = 0; i < runCount; i++) {
+		blockArray[i].compressed = compressed;
+		blockArray[i].record = NULL;
+		if (runs[i].blocks == 0) {
+			blockArray[i].iterator = -1;
+			blockArray[i].blockCounter = -1;
+			blockArray[i].data = NULL;
+			blockArray[i].block = NULL;
+			continue;
+		}
+
+		BF_Block *block;
+		BF_Block_Init(&block);
+		BF_CALL_OR_EXIT(getBlock(fileDesc, runs[i].startBlock, block));
+		blockArray[i].data = BF_Block_GetData(block);
+		blockArray[i].block = block;
+		blockArray[i].iterator = 0;
+		blockArray[i].blockCounter = runs[i].startBlock;
+		blockArray[i].endCounter = runs[i].startBlock + runs[i].blocks;
 
-		// Get a new one
-		BF_Block_Init(&(result->block));
-		BF_CALL_OR_EXIT(BF_AllocateBlock(newfileDesc, result->block));
-		result->data = BF_Block_GetData(result->block);
-		result->iterator = 0;
-		// Initliaze its records to 0
-		int zero = 0;
-		memcpy((int *)&result->data[RECORDS], &zero, sizeof(int));
+		// Skip any empty leading block
+		SR_CALL_OR_EXIT( getNewBlock(fileDesc, blockArray, i) );
 	}
-  	return SR_OK;
+
+	return SR_OK;
 }
 
-static int findMin(mergeBlock *blockArray, int bufferSize, int fieldNo) {
+static int findMin(mergeBlock *blockArray, int runCount, const sortMode *mode) {
 	int minIndex = 0;
 
 	// Find first index which is valid
-	while (minIndex < bufferSize - 1 && blockArray[minIndex].iterator == -1) {
+	while (minIndex < runCount && blockArray[minIndex].iterator == -1) {
 		minIndex++;
 	}
 
 	// Start from there
-	for (int i = minIndex; i < bufferSize - 1; i++) {
-
-		int it = blockArray[i].iterator;
-		int minit = blockArray[minIndex].iterator;
+	for (int i = minIndex; i < runCount; i++) {
 
 		// If invalid index
-		if (it == -1) continue;
+		if (blockArray[i].iterator == -1) continue;
 
-		if (compareRecord((Record *)&blockArray[i].data[RECORD(it)], (Record *)&blockArray[minIndex].data[RECORD(minit)], fieldNo) ) {
+		if (lessRecord(blockArray[i].record, blockArray[minIndex].record, mode) ) {
 			minIndex = i;
 		}
 	}
-	// If minIndex >= bufferSize means that there are not valid indices.
-	return (minIndex >= bufferSize - 1 ? -1 : minIndex);
+	// If minIndex >= runCount means that there are not valid indices.
+	return (minIndex >= runCount ? -1 : minIndex);
 }
 
-static SR_ErrorCode Merge(int fileDesc, int newfileDesc, int bufferSize, int startIndex, int maxBlocks ,int fieldNo) {
+// Merges "runCount" runs of the file fileDesc (at most bufferSize - 1)
+// into the run being written by "result"
+static SR_ErrorCode Merge(int fileDesc, const sortRun *runs, int runCount, runWriter *result, const sortMode *mode) {
 
+	mergeBlock *blockArray = malloc(runCount * sizeof(mergeBlock));
 
-	mergeBlock *blockArray = malloc( (bufferSize - 1) * sizeof(mergeBlock));
+	SR_CALL_OR_EXIT( initMergeArray(fileDesc, blockArray, runs, runCount, mode->compressRuns) );
 
-	SR_CALL_OR_EXIT( initMergeArray(fileDesc, blockArray, bufferSize, startIndex, maxBlocks) );
-
-	// Initialization of result block
-	mergeBlock result;
-	
-	BF_Block_Init(&result.block);
-	BF_CALL_OR_EXIT(BF_AllocateBlock(newfileDesc, result.block));
-	result.data = BF_Block_GetData(result.block);
-	result.iterator = 0;
-	result.blockCounter = 0; // This does not matter here
-	result.endCounter = 0; // This does not matter here
-	int zero = 0;
-	memcpy((int *)&result.data[RECORDS], &zero, sizeof(int));
-
-	// This holds the number of block "teams" that are finished
 	int minIndex;
 	// if minIndex == -1 there are no more valid blocks in array so finish up
-	while( (minIndex = findMin(blockArray, bufferSize, fieldNo)) != -1 ) {
+	// A run that cannot take more records also ends the merge early
+	while( !runFull(result) && (minIndex = findMin(blockArray, runCount, mode)) != -1 ) {
 
-		// Check if result block is filled
-		SR_CALL_OR_EXIT( getNewResultBlock(newfileDesc, &result) );
-
-		int lastit = result.iterator;
-		int minit = blockArray[minIndex].iterator;
-		
-		// Write the min record to result block
-		memcpy(&result.data[RECORD(lastit)], &blockArray[minIndex].data[RECORD(minit)] , sizeof(Record));
+		// Write the min record to result run
+		SR_CALL_OR_EXIT( writeRun(result, blockArray[minIndex].record) );
 
-		// Increase iterators for writing/reading
-		result.iterator++;
 		blockArray[minIndex].iterator++;
 
-		// Increase the number of records in result block
-		int records = (int)result.data[RECORDS];
-		records++;
-		memcpy((int *)&result.data[RECORDS], &records, sizeof(int));
-
 		// Check if we went through whole block
 		SR_CALL_OR_EXIT( getNewBlock(fileDesc, blockArray, minIndex) );
 	}
 
-	// Write last result block
-	BF_Block_SetDirty(result.block);
-	BF_CALL_OR_EXIT(BF_UnpinBlock(result.block));
-	BF_Block_Destroy(&result.block);
+	// Runs cut short by the limit still have a block pinned
+	for (int i = 0; i < runCount; i++) {
+		if (blockArray[i].block != NULL) {
+			BF_CALL_OR_EXIT( unpinBlock(blockArray[i].block) );
+			BF_Block_Destroy(&blockArray[i].block);
+		}
+	}
+
+	free(blockArray);
 
 	return SR_OK;
 }
 
-static SR_ErrorCode PhaseZero(int inputfd, int tempQuickfd, int bufferSize, int fieldNo) {
-	int allBlocks;
-	BF_CALL_OR_EXIT(BF_GetBlockCounter(inputfd, &allBlocks));
+// Utility Function:
+// Returns the time on a monotonic clock, in seconds
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Utility Function:
+// Returns the slot of the sort statistics for "phase", counting it among the phases run
+// Phases past SR_MAX_PHASES share the last slot
+static int phaseSlot(int phase)
+{
+	if (phase >= SR_MAX_PHASES)
+		phase = SR_MAX_PHASES - 1;
+	if (sortStats.phases < phase + 1)
+		sortStats.phases = phase + 1;
+	return phase;
+}
+
+// Utility Function:
+// Adds a merge that wrote a run of "bytes" bytes in "blocks" blocks, taking "seconds",
+// to the statistics of "phase"
+static void countMerge(int phase, long long bytes, long long blocks, double seconds)
+{
+	phase = phaseSlot(phase);
+	sortStats.runs[phase]++;
+	sortStats.merges[phase]++;
+	sortStats.bytes[phase] += bytes;
+	sortStats.blocks[phase] += blocks;
+	sortStats.seconds[phase] += seconds;
+}
+
+// Sorts the input in chunks of bufferSize - 1 blocks, keeping one frame for output,
+// and writes each chunk to tempQuickfd as a run
+// With a frame pool, chunks are as large as the frames taken for each of them
+// The runs are returned in "runs", which must have room for one run per chunk
+static SR_ErrorCode PhaseZero(int inputfd, int tempQuickfd, int bufferSize, sortMode *mode, sortRun *runs, int *runCount) {
+	long long allBlocks;
+	BF_CALL_OR_EXIT(getBlockCounter(inputfd, &allBlocks));
 
 	// 2 arrays, one for blocks, one for data in those blocks
 	// Indices in one array correspond to the other
-	char **blockData = malloc(bufferSize * sizeof(char *));
-	int startIndex = 1;
+	char **blockData = malloc((bufferSize - 1) * sizeof(char *));
+	long long startIndex = 1;
 
-	BF_Block **blockArray = malloc(bufferSize * sizeof(BF_Block *));
+	BF_Block **blockArray = malloc((bufferSize - 1) * sizeof(BF_Block *));
 
 	int allRecords;
+	long long nextBlock = 1;
+	*runCount = 0;
 
-	// Loop until all teams of bufferSize blocks have been sorted
+	// Loop until all teams of chunkSize blocks have been sorted
 	while(startIndex < allBlocks) {
 		allRecords = 0;
 
+		int frames = acquireFrames(mode->pool, bufferSize);
+		int chunkSize = frames - 1;
+
 		// Each index in array has one block's data
-		// Array has bufferSize indices
-		for (int i = 0; i < bufferSize; i++) {
+		for (int i = 0; i < chunkSize; i++) {
 			blockArray[i] = NULL;
 			if (startIndex >= allBlocks) {
 				break;
 			}
 
 			BF_Block_Init(&(blockArray[i]));
-			BF_CALL_OR_EXIT(BF_GetBlock(inputfd, startIndex, blockArray[i]));
+			BF_CALL_OR_EXIT(getBlock(inputfd, startIndex, blockArray[i]));
 
 			blockData[i] = BF_Block_GetData(blockArray[i]);
-			allRecords += (int)blockData[i][RECORDS];
+			allRecords += *(int *)&blockData[i][RECORDS];
 
 			startIndex++;
 		}
 
-		// Sort these bufferSize blocks
-		quickSort(blockData, 0, allRecords - 1, fieldNo);
-
-		// Write the sorted data into the new file
-		for (int i = 0; i < bufferSize; i++) {
-			if (!blockArray[i]) break;
-
-			BF_Block *newBlock;
-			BF_Block_Init(&newBlock);
-			
-			BF_CALL_OR_EXIT(BF_AllocateBlock(tempQuickfd, newBlock));
-			char *data = BF_Block_GetData(newBlock);
-
-			// Since we have a whole block, we can memcpy all the data into new block
-			memcpy(data, blockData[i], BF_BLOCK_SIZE);
+		// The chunk is compacted and sorted in the frames of the input itself.
+		// They are never marked dirty here, so the changes are dropped with them.
+		// A frame already dirty when pinned is written back, though, so records
+		// are only ever swapped in them: the input keeps every record it had
+
+		// Drop what is already known to be past the cutoff before sorting,
+		// by swapping it behind the records kept
+		if (mode->hasCutoff) {
+			int kept = 0;
+			for (int i = 0; i < allRecords; i++) {
+				Record *record = getRecord(blockData, i);
+				if (!lessRecord(&mode->cutoff, record, mode)) {
+					if (i != kept)
+						swapRecord(getRecord(blockData, kept), record);
+					kept++;
+				}
+			}
+			allRecords = kept;
+		}
 
-			BF_Block_SetDirty(newBlock);
-			BF_CALL_OR_EXIT(BF_UnpinBlock(newBlock));
-			BF_Block_Destroy(&newBlock);
+		// Sort these blocks
+		quickSort(blockData, 0, allRecords - 1, mode);
+
+		sortRun *run = &runs[(*runCount)++];
+		run->startBlock = nextBlock;
+		run->blocks = 0;
+		run->pass = 0;
+
+		if (mode->prepare == NULL && !mode->fold && mode->limit == 0 && !mode->compressRuns) {
+			// Write the sorted data into the new file
+			// The BF layer cannot hand a pinned frame over to another file, and its
+			// file layout is its own, so each block is copied into one of the temp file
+			for (int i = 0; i < chunkSize; i++) {
+				if (!blockArray[i]) break;
+
+				BF_Block *newBlock;
+				BF_Block_Init(&newBlock);
+				
+				BF_CALL_OR_EXIT(allocateBlock(tempQuickfd, newBlock));
+				char *data = BF_Block_GetData(newBlock);
+
+				// Since we have a whole block, we can memcpy all the data into new block
+				memcpy(data, blockData[i], BF_BLOCK_SIZE);
+
+				setDirty(newBlock);
+				BF_CALL_OR_EXIT(unpinBlock(newBlock));
+				BF_Block_Destroy(&newBlock);
+				run->blocks++;
+			}
+			run->records = allRecords;
+		}
+		else {
+			// Records may be changed or folded together, so write them one by one
+			runWriter writer;
+			openRunWriter(&writer, tempQuickfd, mode);
+			writer.compressed = mode->compressRuns;
+
+			for (int i = 0; i < allRecords; i++) {
+				Record record;
+				memcpy(&record, getRecord(blockData, i), sizeof(Record));
+				if (mode->prepare != NULL)
+					mode->prepare(&record, mode);
+
+				SR_CALL_OR_EXIT( writeRun(&writer, &record) );
+			}
+
+			SR_CALL_OR_EXIT( closeRunWriter(&writer) );
+			run->blocks = writer.blocks;
+			run->records = writer.written;
+
+			// A run holding "limit" records bounds the output: its last record
+			// is at least as great as the last record of the output
+			if (runFull(&writer)) {
+				Record *last = getRecord(blockData, mode->limit - 1);
+				if (!mode->hasCutoff || lessRecord(last, &mode->cutoff, mode)) {
+					memcpy(&mode->cutoff, last, sizeof(Record));
+					mode->hasCutoff = true;
+				}
+			}
+		}
+		nextBlock += run->blocks;
+		sortStats.bytes[0] += (long long) run->records * sizeof(Record);
+		sortStats.blocks[0] += run->blocks;
 
-			BF_CALL_OR_EXIT(BF_UnpinBlock(blockArray[i]));
+		for (int i = 0; i < chunkSize; i++) {
+			if (!blockArray[i]) break;
+
+			BF_CALL_OR_EXIT(unpinBlock(blockArray[i]));
 			BF_Block_Destroy(&(blockArray[i]));
 		}
+		releaseFrames(mode->pool, frames);
 
-		// Loop until all teams of bufferSize blocks have been sorted
+		// Loop until all teams of chunkSize blocks have been sorted
 	}
 
 	free(blockArray);
@@ -465,145 +1778,959 @@ static SR_ErrorCode PhaseZero(int inputfd, int tempQuickfd, int bufferSize, int
 	return SR_OK;
 }
 
+// Which merges a sort does after Phase Zero, see SR_SetMergePlan
+static SR_MergePlan mergePlan = SR_PLAN_OPTIMAL;
+
+SR_ErrorCode SR_SetMergePlan(SR_MergePlan plan)
+{
+	if (plan != SR_PLAN_BALANCED && plan != SR_PLAN_OPTIMAL)
+		return SR_ERROR;
+
+	mergePlan = plan;
+
+	return SR_OK;
+}
+
+// Carries out the merges a plan picks: into the temp file while sorting,
+// onto stdout for SR_PrintMergePlan
+typedef struct mergeStep {
+	// Merges the "groupSize" runs of "group" into "result", whose pass is already set
+	SR_ErrorCode (*merge)(struct mergeStep *step, const sortRun *group, int groupSize, sortRun *result);
+	sortMode *mode;		// Frames are drawn from mode->pool, if set
+	int bufferSize;
+	void *context;
+} mergeStep;
+
+// Utility Function:
+// Gives back the frames of the last merge and takes those of the next one,
+// so that a plan adapts its fan-in to a changing share of a frame pool
+static void nextFrames(const mergeStep *step, int *frames)
+{
+	releaseFrames(step->mode->pool, *frames);
+	*frames = acquireFrames(step->mode->pool, step->bufferSize);
+}
+
+// Utility Function:
+// SR_PLAN_BALANCED: every pass merges the runs of the pass before it in
+// groups of frames - 1, in order, until they can all be merged at once
+static SR_ErrorCode balancedMerges(mergeStep *step, sortRun **runs, sortRun **spare, int *runCount, int *frames)
+{
+	while (*runCount > *frames - 1) {
+		int nextCount = 0;
+
+		for (int i = 0; i < *runCount; ) {
+			int fanIn = *frames - 1;
+			int groupSize = (*runCount - i < fanIn) ? *runCount - i : fanIn;
+
+			sortRun *result = &(*spare)[nextCount++];
+			result->pass = (*runs)[i].pass + 1;
+			SR_CALL_OR_EXIT( step->merge(step, &(*runs)[i], groupSize, result) );
+
+			i += groupSize;
+			nextFrames(step, frames);
+		}
+
+		sortRun *swap = *runs;
+		*runs = *spare;
+		*spare = swap;
+		*runCount = nextCount;
+	}
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Restores the min-heap order on run length below "index"
+static void siftRun(sortRun *heap, int size, int index)
+{
+	for (;;) {
+		int least = index, left = 2 * index + 1, right = left + 1;
+		if (left < size && heap[left].blocks < heap[least].blocks)
+			least = left;
+		if (right < size && heap[right].blocks < heap[least].blocks)
+			least = right;
+		if (least == index)
+			return;
+
+		sortRun swap = heap[index];
+		heap[index] = heap[least];
+		heap[least] = swap;
+		index = least;
+	}
+}
+
+// Utility Function:
+// SR_PLAN_OPTIMAL: the F-ary Huffman merge, which reads and writes the fewest
+// blocks for a fan-in F = frames - 1. The shortest runs are always merged
+// first; the first merge takes just enough of them, ((n - 2) mod (F - 1)) + 2,
+// as if padded with empty runs, for every merge after it to take F runs and
+// the last to take F as well. The rule is applied again before every merge,
+// so a fan-in that changes along the way is followed
+// On random-access storage this subsumes polyphase and cascade schedules,
+// which only exist to balance runs over a fixed number of tapes
+static SR_ErrorCode optimalMerges(mergeStep *step, sortRun *runs, int *runCount, int *frames)
+{
+	sortRun group[BF_BUFFER_SIZE];
+	int size = *runCount;
+
+	for (int i = size / 2 - 1; i >= 0; i--)
+		siftRun(runs, size, i);
+
+	while (size > *frames - 1) {
+		int fanIn = *frames - 1;
+		int groupSize = (size - 2) % (fanIn - 1) + 2;
+
+		sortRun result;
+		result.pass = 0;
+		for (int i = 0; i < groupSize; i++) {
+			group[i] = runs[0];
+			runs[0] = runs[--size];
+			siftRun(runs, size, 0);
+
+			if (group[i].pass >= result.pass)
+				result.pass = group[i].pass + 1;
+		}
+
+		SR_CALL_OR_EXIT( step->merge(step, group, groupSize, &result) );
+
+		// Push the merged run, sifting it up to its place
+		int index = size++;
+		runs[index] = result;
+		while (index > 0 && runs[(index - 1) / 2].blocks > runs[index].blocks) {
+			sortRun swap = runs[index];
+			runs[index] = runs[(index - 1) / 2];
+			runs[(index - 1) / 2] = swap;
+			index = (index - 1) / 2;
+		}
+
+		nextFrames(step, frames);
+	}
+
+	*runCount = size;
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Merges runs following "plan" until the last *frames - 1 of them can be merged at once
+// *frames holds the frames taken for that last merge on return
+// "spare" must have room for as many runs as "runs"
+static SR_ErrorCode planMerges(mergeStep *step, SR_MergePlan plan,
+	sortRun **runs, sortRun **spare, int *runCount, int *frames)
+{
+	if (plan == SR_PLAN_BALANCED)
+		return balancedMerges(step, runs, spare, runCount, frames);
+
+	return optimalMerges(step, *runs, runCount, frames);
+}
+
+// Utility Function:
+// The merge of a sort, from runs of the temp file into a new run of it
+static SR_ErrorCode mergeIntoTemp(mergeStep *step, const sortRun *group, int groupSize, sortRun *result)
+{
+	tempSpace *space = step->context;
+	double start = now();
+
+	// The merged run is never longer than its inputs together, unless it is
+	// compressed: records may then code worse next to their new neighbours
+	long long blocks = 0, records = 0;
+	for (int i = 0; i < groupSize; i++) {
+		blocks += group[i].blocks;
+		records += group[i].records;
+	}
+	long long codedBlocks = (records + CODED_MIN_RECORDS - 1) / CODED_MIN_RECORDS;
+	if (step->mode->compressRuns && blocks < codedBlocks)
+		blocks = codedBlocks;
+
+	runWriter writer;
+	openRunWriter(&writer, space->fileDesc, step->mode);
+	writer.space = space;
+	writer.compressed = step->mode->compressRuns;
+	writer.nextBlock = allocateExtent(space, blocks);
+
+	result->startBlock = writer.nextBlock;
+	SR_CALL_OR_EXIT( Merge(space->fileDesc, group, groupSize, &writer, step->mode) );
+	SR_CALL_OR_EXIT( closeRunWriter(&writer) );
+	result->blocks = writer.blocks;
+	result->records = writer.written;
+
+	// Give back what the merged run did not use, and the runs it was made of
+	SR_CALL_OR_EXIT( freeExtent(space, writer.nextBlock, blocks - writer.blocks) );
+	for (int i = 0; i < groupSize; i++)
+		SR_CALL_OR_EXIT( freeExtent(space, group[i].startBlock, group[i].blocks) );
+
+	countMerge(result->pass, (long long) writer.written * sizeof(Record), writer.blocks, now() - start);
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Sorts the records of the already open file inputfd according to "mode"
+// The result is written to output_filename, or handed to "emit" if that is set
+SR_ErrorCode sortFile(
+	int inputfd,
+	const char* output_filename,
+	sortMode *mode,
+	int bufferSize,
+	SR_ErrorCode (*emit)(const Record *record, void *sink),
+	void *sink)
+{
+	// Every run of every pass lives in a single temp file, see tempSpace
+	char tempFileName[TEMP_PATH_SIZE];
+	int tempfd;
+	SR_CALL_OR_EXIT( makeTempFileName(tempFileName, TEMP_PATH_SIZE) );
+
+	long long inputBlocks;
+	BF_CALL_OR_EXIT(getBlockCounter(inputfd, &inputBlocks));
+
+	// Phase Zero makes one run per chunk, every other pass fewer
+	// Chunks drawn from a frame pool may be as small as 2 blocks
+	int minChunk = (mode->pool != NULL) ? 2 : bufferSize - 1;
+	long long maxRuns = (inputBlocks - 1) / minChunk + 1;
+	if (maxRuns > INT_MAX)
+		return SR_ERROR;
+	sortRun *runs = malloc(maxRuns * sizeof(sortRun));
+	sortRun *nextRuns = malloc(maxRuns * sizeof(sortRun));
+	int runCount;
+	
+	SR_CALL_OR_EXIT( SR_CreateFile(tempFileName) );
+	SR_CALL_OR_EXIT( SR_OpenFile(tempFileName, &tempfd) );
+
+	// Phase Zero copies the input, every merge then mostly reuses the blocks
+	// of the runs merged before it; later segments are left to grow
+	preallocateFile(tempFileName, (inputBlocks < newSegmentBlocks) ? inputBlocks : newSegmentBlocks);
+
+	mode->compressRuns = tempCompression;
+	memset(&sortStats, 0, sizeof(SR_SortStats));
+	double start = now();
+
+  // Initiate Phase 0 (quickSort) from input file to the temp file
+	SR_CALL_OR_EXIT( PhaseZero(inputfd, tempfd, bufferSize, mode, runs, &runCount) );
+	sortStats.runs[phaseSlot(0)] = runCount;
+	sortStats.seconds[0] = now() - start;
+
+	tempSpace space;
+	SR_CALL_OR_EXIT( openTempSpace(&space, tempfd, runCount + 1) );
+
+	// Phase One - n
+	// Merge runs as the plan says, until the frames of the last merge can take all that are left
+	mergeStep step = { mergeIntoTemp, mode, bufferSize, &space };
+	int frames = acquireFrames(mode->pool, bufferSize);
+	SR_CALL_OR_EXIT( planMerges(&step, mergePlan, &runs, &nextRuns, &runCount, &frames) );
+
+	// A single run can only come straight from Phase Zero, which wrote it
+	// from block 1 on, so the temp file already is the output, unless compressed
+	bool renamed = false;
+	if (emit == NULL && runCount == 1 && runs[0].startBlock == 1 && !mode->compressRuns) {
+		SR_CALL_OR_EXIT( SR_CloseFile(tempfd) );
+		renamed = (renameFile(tempFileName, output_filename) == 0);
+
+		// A temp directory on another file system cannot be renamed across, so copy instead
+		if (!renamed)
+			SR_CALL_OR_EXIT( SR_OpenFile(tempFileName, &tempfd) );
+	}
+
+	if (!renamed) {
+		// The last merge writes straight to the output
+		runWriter writer;
+		int outputfd = -1;
+		start = now();
+
+		int pass = 0;
+		for (int i = 0; i < runCount; i++)
+			if (runs[i].pass >= pass)
+				pass = runs[i].pass + 1;
+
+		if (emit == NULL) {
+			removeFile(output_filename);
+			SR_CALL_OR_EXIT( SR_CreateFile(output_filename) );
+			SR_CALL_OR_EXIT( SR_OpenFile(output_filename, &outputfd) );
+
+			// Its size is only known when no records are folded or dropped
+			if (!mode->fold && mode->limit == 0)
+				preallocateFile(output_filename, (inputBlocks < newSegmentBlocks) ? inputBlocks : newSegmentBlocks);
+		}
+
+		openRunWriter(&writer, outputfd, mode);
+		writer.emit = emit;
+		writer.sink = sink;
+		SR_CALL_OR_EXIT( Merge(tempfd, runs, runCount, &writer, mode) );
+		SR_CALL_OR_EXIT( closeRunWriter(&writer) );
+
+		if (emit == NULL)
+			SR_CALL_OR_EXIT( SR_CloseFile(outputfd) );
+
+		countMerge(pass, (long long) writer.written * sizeof(Record), writer.blocks, now() - start);
+
+		SR_CALL_OR_EXIT( SR_CloseFile(tempfd) );
+		removeFile(tempFileName);
+	}
+	releaseFrames(mode->pool, frames);
+
+	free(space.extents);
+	free(runs);
+	free(nextRuns);
+
+	if (emit != NULL)
+		return SR_OK;
+
+	// Remember the order in the output's META block, so that it can be relied upon later
+	int outputfd;
+	SR_CALL_OR_EXIT( SR_OpenFile(output_filename, &outputfd) );
+	SR_CALL_OR_EXIT( setSortedOn(outputfd, mode->fieldNo) );
+	SR_CALL_OR_EXIT( SR_CloseFile(outputfd) );
+
+	return SR_OK;
+}
+
+// Totals of SR_PrintMergePlan
+typedef struct planPrinter {
+	int merges;
+	long long blocks;	// Blocks read by the merges, which write as many
+} planPrinter;
+
+// Utility Function:
+// The merge of SR_PrintMergePlan, which only prints what would be merged
+static SR_ErrorCode printMerge(mergeStep *step, const sortRun *group, int groupSize, sortRun *result)
+{
+	planPrinter *printer = step->context;
+
+	result->startBlock = 0;
+	result->blocks = 0;
+
+	printf("merge %d (pass %d): %d runs,", ++printer->merges, result->pass, groupSize);
+	for (int i = 0; i < groupSize; i++) {
+		printf("%s%lld", i ? "+" : " ", group[i].blocks);
+		result->blocks += group[i].blocks;
+	}
+	printf(" -> %lld blocks\n", result->blocks);
+
+	printer->blocks += result->blocks;
+
+	return SR_OK;
+}
+
+SR_ErrorCode SR_PrintMergePlan(const char* input_filename, int bufferSize, SR_MergePlan plan)
+{
+	if (bufferSize < 3 || bufferSize > BF_BUFFER_SIZE || (plan != SR_PLAN_BALANCED && plan != SR_PLAN_OPTIMAL))
+		return SR_ERROR;
+
+	int inputfd;
+	long long inputBlocks;
+	SR_CALL_OR_EXIT( SR_OpenFile(input_filename, &inputfd) );
+	BF_CALL_OR_EXIT(getBlockCounter(inputfd, &inputBlocks));
+	SR_CALL_OR_EXIT( SR_CloseFile(inputfd) );
+
+	// Phase Zero makes a run out of every bufferSize - 1 blocks
+	long long dataBlocks = inputBlocks - 1;
+	int chunkSize = bufferSize - 1;
+	if ((dataBlocks + chunkSize - 1) / chunkSize > INT_MAX)
+		return SR_ERROR;
+	int runCount = (dataBlocks + chunkSize - 1) / chunkSize;
+	sortRun *runs = malloc((runCount + 1) * sizeof(sortRun));
+	sortRun *spare = malloc((runCount + 1) * sizeof(sortRun));
+	if (runs == NULL || spare == NULL)
+		return SR_ERROR;
+
+	for (int i = 0; i < runCount; i++) {
+		runs[i].startBlock = 1 + (long long) i * chunkSize;
+		runs[i].blocks = (i < runCount - 1) ? chunkSize : dataBlocks - (long long) i * chunkSize;
+		runs[i].pass = 0;
+	}
+
+	printf("%s plan, %d blocks of memory\n", plan == SR_PLAN_BALANCED ? "balanced" : "optimal", bufferSize);
+	printf("phase zero: %d runs of up to %d blocks, %lld blocks\n", runCount, chunkSize, dataBlocks);
+
+	sortMode mode;
+	initSortMode(&mode, 0);
+	planPrinter printer = { 0, 0 };
+	mergeStep step = { printMerge, &mode, bufferSize, &printer };
+	int frames = bufferSize;
+	SR_CALL_OR_EXIT( planMerges(&step, plan, &runs, &spare, &runCount, &frames) );
+
+	if (runCount > 1) {
+		// The last merge, into the output
+		int pass = 0;
+		for (int i = 0; i < runCount; i++)
+			if (runs[i].pass >= pass)
+				pass = runs[i].pass + 1;
+
+		sortRun output;
+		output.pass = pass;
+		printf("final ");
+		SR_CALL_OR_EXIT( printMerge(&step, runs, runCount, &output) );
+	}
+
+	// Phase Zero reads the input and writes it once as well
+	printf("total: %d merges, %lld blocks read, %lld blocks written\n",
+		printer.merges, printer.blocks + dataBlocks, printer.blocks + dataBlocks);
+
+	free(runs);
+	free(spare);
+
+	return SR_OK;
+}
+
 SR_ErrorCode SR_SortedFile(
 	const char* input_filename,
 	const char* output_filename,
 	int fieldNo,
 	int bufferSize)
 {
-	char * tempFileNames[] = { "tempA.db", "tempB.db" };
-	int tempFileFds[] = { -1, -1 };
-	
-	// Create tempA
-	SR_CALL_OR_EXIT( SR_CreateFile(tempFileNames[0]) );
-	SR_CALL_OR_EXIT( SR_OpenFile(tempFileNames[0], &tempFileFds[0]) );
+	if (fieldNo < 0 || fieldNo > 3 || bufferSize < 3 || bufferSize > BF_BUFFER_SIZE)
+		return SR_ERROR;
 
 	int inputfd;
 	SR_CALL_OR_EXIT( SR_OpenFile(input_filename, &inputfd) );
 
-  // Initiate Phase 0 (quickSort) from input file to tempA
-	SR_CALL_OR_EXIT( PhaseZero(inputfd, tempFileFds[0], bufferSize, fieldNo) );
+	sortMode mode;
+	initSortMode(&mode, fieldNo);
+	SR_ErrorCode rv = sortFile(inputfd, output_filename, &mode, bufferSize, NULL, NULL);
 
 	SR_CALL_OR_EXIT( SR_CloseFile(inputfd) );
-	
-  // Create tempB
-	SR_CALL_OR_EXIT( SR_CreateFile(tempFileNames[1]) );
-	SR_CALL_OR_EXIT( SR_OpenFile(tempFileNames[1], &tempFileFds[1]) );
 
-	// Index here refers to the tempFileFds array
-	// At Start tempFileFds[0] = tempA, tempFileFds[1] = tempB
-	int index = 1;
-	int maxBlocks = bufferSize;
-	int allBlocks;
-	BF_CALL_OR_EXIT(BF_GetBlockCounter(tempFileFds[0], &allBlocks));
+	return rv;
+}
+
+SR_ErrorCode SR_SortedDistinct(
+	const char* input_filename,
+	const char* output_filename,
+	int fieldNo,
+	int bufferSize,
+	SR_DistinctMode distinct)
+{
+	if (fieldNo < 0 || fieldNo > 3 || bufferSize < 3 || bufferSize > BF_BUFFER_SIZE ||
+	    (distinct != SR_DISTINCT_KEY && distinct != SR_DISTINCT_RECORD))
+		return SR_ERROR;
+
+	int inputfd;
+	SR_CALL_OR_EXIT( SR_OpenFile(input_filename, &inputfd) );
 
+	// Whole records only end up next to their duplicates if ties are broken on every field
+	sortMode mode;
+	initSortMode(&mode, fieldNo);
+	mode.wholeRecord = (distinct == SR_DISTINCT_RECORD);
+	mode.fold = true;
+	SR_ErrorCode rv = sortFile(inputfd, output_filename, &mode, bufferSize, NULL, NULL);
 
-	// Phase One - n
-	do {
-		
-		for (int i = 1; i < allBlocks - 1; i += (maxBlocks * (bufferSize - 1)) ) {
-			// i is the first blockCounter from all the bufferSize - 1 teams that are to be merged
-			// Take !index as input, and index as output, and merge
-			// Merge bufferSize - 1 teams of blocks
-			Merge(tempFileFds[!index], tempFileFds[index], bufferSize, i, maxBlocks, fieldNo);
-			// i now gets increased by the size of bufferSize - 1 teams
-			// So next i will be the first block of the next bufferSize - 1 teams that are to be merged
+	SR_CALL_OR_EXIT( SR_CloseFile(inputfd) );
+
+	return rv;
+}
+
+// Utility Function:
+// Restores the max-heap property of heap[0 .. size) below "index"
+static void siftDown(Record *heap, int size, int index, const sortMode *mode)
+{
+	while (true)
+	{
+		int largest = index, left = 2 * index + 1, right = left + 1;
+
+		if (left < size && lessRecord(&heap[largest], &heap[left], mode))
+			largest = left;
+		if (right < size && lessRecord(&heap[largest], &heap[right], mode))
+			largest = right;
+
+		if (largest == index)
+			return;
+
+		swapRecord(&heap[index], &heap[largest]);
+		index = largest;
+	}
+}
+
+// Utility Function:
+// Single pass Top-K: the k least records seen so far are kept in a max-heap,
+// whose root is the record the next smaller one replaces
+static SR_ErrorCode topKHeap(int inputfd, const char* output_filename, const sortMode *mode, int k)
+{
+	Record *heap = malloc(k * sizeof(Record));
+	if (heap == NULL)
+		return SR_ERROR;
+
+	// A single pass over the input, which counts as Phase Zero writing one run
+	memset(&sortStats, 0, sizeof(SR_SortStats));
+	double start = now();
+	int phase = phaseSlot(0);
+
+	long long allBlocks;
+	int size = 0;
+	BF_CALL_OR_EXIT(getBlockCounter(inputfd, &allBlocks));
+
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	for (long long i = 1; i < allBlocks; i++)
+	{
+		BF_CALL_OR_EXIT(getBlock(inputfd, i, block));
+		char *data = BF_Block_GetData(block);
+
+		int records = *(int *)&data[RECORDS];
+		for (int j = 0; j < records; j++)
+		{
+			Record *record = (Record *) &data[RECORD(j)];
+
+			if (size < k)
+			{
+				// Sift the new record up to its place
+				int index = size++;
+				memcpy(&heap[index], record, sizeof(Record));
+				while (index > 0 && lessRecord(&heap[(index - 1) / 2], &heap[index], mode))
+				{
+					swapRecord(&heap[(index - 1) / 2], &heap[index]);
+					index = (index - 1) / 2;
+				}
+			}
+			else if (lessRecord(record, &heap[0], mode))
+			{
+				memcpy(&heap[0], record, sizeof(Record));
+				siftDown(heap, size, 0, mode);
+			}
 		}
-		
-    // Close and remove the input file
-		SR_CALL_OR_EXIT( SR_CloseFile(tempFileFds[!index]) );
-		remove(tempFileNames[!index]);
-		
-    // Create a new one
-		SR_CALL_OR_EXIT( SR_CreateFile(tempFileNames[!index]) );
-		SR_CALL_OR_EXIT( SR_OpenFile(tempFileNames[!index], &tempFileFds[!index]) );
 
+		BF_CALL_OR_EXIT(unpinBlock(block));
+	}
 
-		// Switch indices
-		index = !index;
-		// Now the new file we created above will be the new output file
-		// And the old file which was output will now be input
+	BF_Block_Destroy(&block);
 
-		maxBlocks *= (bufferSize - 1);
+	// Heapsort in place, the greatest record goes last
+	for (int end = size - 1; end > 0; end--)
+	{
+		swapRecord(&heap[0], &heap[end]);
+		siftDown(heap, end, 0, mode);
+	}
 
-		// maxBlocks is the max size that a "team" of blocks can have
-		// if maxBlocks is more than all the blocks in file stop merging
-	} while(maxBlocks < allBlocks - 1);
+	int outputfd;
+	removeFile(output_filename);
+	SR_CALL_OR_EXIT( SR_CreateFile(output_filename) );
+	SR_CALL_OR_EXIT( SR_OpenFile(output_filename, &outputfd) );
 
-  // Change the last outputfile to output_fileName
-	SR_CALL_OR_EXIT( SR_CloseFile(tempFileFds[!index]) );
+	runWriter writer;
+	openRunWriter(&writer, outputfd, mode);
+	for (int i = 0; i < size; i++)
+		SR_CALL_OR_EXIT( writeRun(&writer, &heap[i]) );
+	SR_CALL_OR_EXIT( closeRunWriter(&writer) );
+
+	SR_CALL_OR_EXIT( setSortedOn(outputfd, mode->fieldNo) );
+	SR_CALL_OR_EXIT( SR_CloseFile(outputfd) );
+
+	free(heap);
+
+	sortStats.runs[phase] = 1;
+	sortStats.bytes[phase] = (long long) writer.written * sizeof(Record);
+	sortStats.blocks[phase] = writer.blocks;
+	sortStats.seconds[phase] = now() - start;
 
-	rename(tempFileNames[!index], output_filename);
-	
-	SR_CALL_OR_EXIT( SR_CloseFile(tempFileFds[index]) );
-	remove(tempFileNames[index]);
-	
 	return SR_OK;
 }
 
+SR_ErrorCode SR_SortedTopK(
+	const char* input_filename,
+	const char* output_filename,
+	int fieldNo,
+	int k,
+	int bufferSize)
+{
+	if (fieldNo < 0 || fieldNo > 3 || k < 1 || bufferSize < 3 || bufferSize > BF_BUFFER_SIZE)
+		return SR_ERROR;
+
+	int inputfd;
+	SR_CALL_OR_EXIT( SR_OpenFile(input_filename, &inputfd) );
+
+	sortMode mode;
+	initSortMode(&mode, fieldNo);
+	mode.limit = k;
+
+	// The heap may take all the memory but the frame the input is read through
+	SR_ErrorCode rv;
+	if (k <= (bufferSize - 1) * (int) MAXRECORDS)
+		rv = topKHeap(inputfd, output_filename, &mode, k);
+	else
+		rv = sortFile(inputfd, output_filename, &mode, bufferSize, NULL, NULL);
+
+	SR_CALL_OR_EXIT( SR_CloseFile(inputfd) );
+
+	return rv;
+}
+
+// Shared by the worker threads of SR_RunSortJobs
+typedef struct sortScheduler {
+	framePool pool;
+	SR_SortJob *jobs;
+	int jobCount;
+	int next;		// Next job to start, under pool.lock
+} sortScheduler;
+
 // Utility Function:
-// Returns the given value's length as a string
-static int padding(int val)
+// Runs one job of SR_RunSortJobs, with its frames drawn from the pool
+static SR_ErrorCode runSortJob(SR_SortJob *job, framePool *pool)
 {
-	char IntToStr[12];
-	sprintf(IntToStr, "%d", val);
+	if (job->fieldNo < 0 || job->fieldNo > 3)
+		return SR_ERROR;
 
-	return strlen(IntToStr);
+	int inputfd;
+	SR_CALL_OR_EXIT( SR_OpenFile(job->input_filename, &inputfd) );
+
+	sortMode mode;
+	initSortMode(&mode, job->fieldNo);
+	mode.pool = pool;
+	SR_ErrorCode rv = sortFile(inputfd, job->output_filename, &mode, pool->total, NULL, NULL);
+
+	SR_CALL_OR_EXIT( SR_CloseFile(inputfd) );
+
+	return rv;
 }
 
-SR_ErrorCode SR_PrintAllEntries(int fileDesc)
+// Utility Function:
+// Worker thread of SR_RunSortJobs, runs jobs until there are none left
+static void * sortWorker(void *arg)
 {
-	if (!isSorted(fileDesc))
-		return SR_BF_ERROR;
-	
-	int blocks;
-	BF_CALL_OR_EXIT(BF_GetBlockCounter(fileDesc, &blocks));
+	sortScheduler *scheduler = arg;
+	framePool *pool = &scheduler->pool;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		if (scheduler->next >= scheduler->jobCount) {
+			// Leave the frames of this worker to the jobs still running
+			pool->active--;
+			pthread_cond_broadcast(&pool->released);
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		SR_SortJob *job = &scheduler->jobs[scheduler->next++];
+		pthread_mutex_unlock(&pool->lock);
+
+		job->result = runSortJob(job, pool);
+		memcpy(&job->stats, &sortStats, sizeof(SR_SortStats));
+	}
+}
+
+SR_ErrorCode SR_RunSortJobs(SR_SortJob *jobs, int jobCount, int threads, int bufferSize)
+{
+	if (jobCount < 0 || threads < 1 || bufferSize < 3 || bufferSize > BF_BUFFER_SIZE)
+		return SR_ERROR;
+
+	// Every job needs at least 3 frames for its chunks and merges, plus one
+	// kept out of the pool for the META block pins of opening and closing files
+	if (threads > bufferSize / 4)
+		threads = bufferSize / 4;
+	if (threads > jobCount)
+		threads = jobCount;
+
+	for (int i = 0; i < jobCount; i++)
+		jobs[i].result = SR_ERROR;
+
+	sortScheduler scheduler;
+	pthread_mutex_init(&scheduler.pool.lock, NULL);
+	pthread_cond_init(&scheduler.pool.released, NULL);
+	scheduler.pool.total = bufferSize - threads;
+	scheduler.pool.free = bufferSize - threads;
+	scheduler.pool.active = threads;
+	scheduler.jobs = jobs;
+	scheduler.jobCount = jobCount;
+	scheduler.next = 0;
+
+	pthread_t workers[BF_BUFFER_SIZE / 4];
+	int started = 0;
+	for (; started < threads; started++)
+		if (pthread_create(&workers[started], NULL, sortWorker, &scheduler) != 0)
+			break;
+
+	// Workers that could not be started have no share of the frames
+	if (started < threads) {
+		pthread_mutex_lock(&scheduler.pool.lock);
+		scheduler.pool.active = started;
+		pthread_mutex_unlock(&scheduler.pool.lock);
+	}
+
+	// With no thread at all, the jobs run one by one in this one
+	if (started == 0) {
+		scheduler.pool.active = 1;
+		sortWorker(&scheduler);
+	}
+
+	for (int i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_cond_destroy(&scheduler.pool.released);
+	pthread_mutex_destroy(&scheduler.pool.lock);
+
+	for (int i = 0; i < jobCount; i++)
+		if (jobs[i].result != SR_OK)
+			return jobs[i].result;
+
+	return SR_OK;
+}
+
+// A position in a file, walked back one record at a time
+// The block of the position stays pinned while its records are handed out
+typedef struct backCursor {
+	int fileDesc;
+	BF_Block *block;		// Pinned block of the position, NULL if none
+	long long blockNum;		// Block of the position
+	int slot;				// Records of that block before the position
+	bool dirty;				// Records of the pinned block were overwritten
+	long long blocks;		// Blocks pinned so far
+	struct backCursor *partner;	// The other cursor over the same file, or NULL, see pinSharedBlock
+} backCursor;
 
-	printf("\n\n");
-	printf("+-----------+---------------+--------------------+--------------------+\n");
-	printf("|ID         |NAME           |SURNAME             |CITY                |\n");
-	printf("+-----------+---------------+--------------------+--------------------+\n");
+// Utility Function:
+// Places the cursor before slot "slot" of block blockNum of fileDesc,
+// which may be one past the last record of the block, or of the file
+// partner, if not NULL, is another cursor over the same file
+static void openBackCursor(backCursor *cursor, int fileDesc, long long blockNum, int slot, backCursor *partner)
+{
+	cursor->fileDesc = fileDesc;
+	cursor->block = NULL;
+	cursor->blockNum = blockNum;
+	cursor->slot = slot;
+	cursor->dirty = false;
+	cursor->blocks = 0;
+	cursor->partner = partner;
+}
+
+// Utility Function:
+// Pins block blockNum of the cursor, sharing the pin of its partner
+static SR_ErrorCode pinBackCursor(backCursor *cursor)
+{
+	const backCursor *partner = cursor->partner;
+	BF_CALL_OR_EXIT(pinSharedBlock(cursor->fileDesc, cursor->blockNum, &cursor->block,
+	                               partner ? partner->block : NULL, partner ? partner->blockNum : 0));
+	cursor->blocks++;
 
-	int records = 0;
-	for (int i = 1; i < blocks; i++)
+	return SR_OK;
+}
+
+// Utility Function:
+// Unpins the block of the cursor, if any
+static SR_ErrorCode releaseBackCursor(backCursor *cursor)
+{
+	if (cursor->block == NULL)
+		return SR_OK;
+
+	const backCursor *partner = cursor->partner;
+	BF_CALL_OR_EXIT(unpinSharedBlock(&cursor->block, cursor->dirty, partner ? partner->block : NULL));
+	cursor->dirty = false;
+
+	return SR_OK;
+}
+
+// Utility Function:
+// Moves the cursor back by one record and points "record" to it,
+// or sets it to NULL once the cursor is at the first record of the file
+static SR_ErrorCode stepBack(backCursor *cursor, Record **record)
+{
+	while (cursor->slot == 0)
 	{
-		BF_Block * block;
-		BF_Block_Init(&block);
+		SR_CALL_OR_EXIT( releaseBackCursor(cursor) );
+		if (--cursor->blockNum <= META)
+		{
+			cursor->blockNum = META;
+			*record = NULL;
+			return SR_OK;
+		}
+
+		SR_CALL_OR_EXIT( pinBackCursor(cursor) );
+		cursor->slot = *(int *) &BF_Block_GetData(cursor->block)[RECORDS];
+	}
+
+	// A position inside a block is pinned on the first step back from it
+	if (cursor->block == NULL)
+		SR_CALL_OR_EXIT( pinBackCursor(cursor) );
+
+	cursor->slot--;
+	*record = (Record *) &BF_Block_GetData(cursor->block)[RECORD(cursor->slot)];
+
+	return SR_OK;
+}
 
-		BF_CALL_OR_EXIT(BF_GetBlock(fileDesc, i, block));
+// Utility Function:
+// Copies the records of fileDesc from slot prefixSlot of block prefixBlock on
+// into the new sorted-format file tailName, returning their number in "records"
+static SR_ErrorCode copyTail(int fileDesc, long long prefixBlock, int prefixSlot, const char *tailName, long long *records)
+{
+	long long blocks;
+	BF_CALL_OR_EXIT(getBlockCounter(fileDesc, &blocks));
+
+	int tailfd;
+	SR_CALL_OR_EXIT( SR_CreateFile(tailName) );
+	SR_CALL_OR_EXIT( SR_OpenFile(tailName, &tailfd) );
 
-		char * data = BF_Block_GetData(block);
-		for (int j = 0; j < (int) data[RECORDS]; j++)
+	loadWriter writer = { tailfd, NULL, NULL, 0 };
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	*records = 0;
+	for (long long i = prefixBlock; i < blocks; i++)
+	{
+		BF_CALL_OR_EXIT(getBlock(fileDesc, i, block));
+		char *data = BF_Block_GetData(block);
+
+		int first = (i == prefixBlock) ? prefixSlot : 0;
+		int count = *(int *) &data[RECORDS] - first;
+		if (count > 0)
 		{
-			Record * record = (Record *) &data[RECORD(j)];
-			int whitespace;
+			SR_CALL_OR_EXIT( writeLoadedRecords(&writer, (Record *) &data[RECORD(first)], count) );
+			*records += count;
+		}
 
-			printf("|%d", record->id);
-			whitespace = 11 - padding(record->id);
-			for (int k = 0; k < whitespace; k++) printf(" ");
+		BF_CALL_OR_EXIT(unpinBlock(block));
+	}
 
-			printf("|%s", record->name);
-			whitespace = 15 - strlen(record->name);
-			for (int k = 0; k < whitespace; k++) printf(" ");
+	BF_Block_Destroy(&block);
+	SR_CALL_OR_EXIT( closeLoadWriter(&writer) );
 
-			printf("|%s", record->surname);
-			whitespace = 20 - strlen(record->surname);
-			for (int k = 0; k < whitespace; k++) printf(" ");
+	return SR_CloseFile(tailfd);
+}
 
-			printf("|%s", record->city);
-			whitespace = 20 - strlen(record->city);
-			for (int k = 0; k < whitespace; k++) printf(" ");
+// Utility Function:
+// Merges the sorted file sortedName into fileDesc, whose records up to slot
+// prefixSlot of block prefixBlock are sorted and the rest are those of sortedName
+// The merge starts from the greatest records, writing them over the last
+// slots of the file: the slot written is always past the prefix records not
+// yet merged, and once the tail runs out the rest of the prefix is in place
+// On failure the pins are still let go of, but the records of the tail not
+// merged yet are only in sortedName, and the slots they go to hold stale ones
+static SR_ErrorCode mergeTail(int fileDesc, long long prefixBlock, int prefixSlot, const char *sortedName, const sortMode *mode)
+{
+	double start = now();
+
+	int sortedfd;
+	long long blocks, sortedBlocks;
+	SR_CALL_OR_EXIT( SR_OpenFile(sortedName, &sortedfd) );
+
+	// The output cursor catches up with the prefix on its blocks
+	backCursor prefix, tail, output;
+	openBackCursor(&prefix, fileDesc, prefixBlock, prefixSlot, &output);
+	openBackCursor(&tail, sortedfd, 0, 0, NULL);
+	openBackCursor(&output, fileDesc, 0, 0, &prefix);
+
+	Record *prefixRecord, *tailRecord, *slot;
+	long long written = 0;
+	SR_ErrorCode rv = SR_OK;
+	if (getBlockCounter(fileDesc, &blocks) != BF_OK || getBlockCounter(sortedfd, &sortedBlocks) != BF_OK)
+		rv = SR_BF_ERROR;
+	else
+	{
+		tail.blockNum = sortedBlocks;
+		output.blockNum = blocks;
+		rv = stepBack(&prefix, &prefixRecord);
+		if (rv == SR_OK)
+			rv = stepBack(&tail, &tailRecord);
+	}
 
-			printf("|\n+-----------+---------------+--------------------+--------------------+\n");
-			records++;
+	while (rv == SR_OK && tailRecord != NULL)
+	{
+		rv = stepBack(&output, &slot);
+		if (rv == SR_OK && slot == NULL)
+			rv = SR_ERROR;
+		if (rv != SR_OK)
+			break;
+		output.dirty = true;
+
+		// On equal keys the prefix record goes first, so it is written last
+		if (prefixRecord != NULL && lessRecord(tailRecord, prefixRecord, mode))
+		{
+			memcpy(slot, prefixRecord, sizeof(Record));
+			rv = stepBack(&prefix, &prefixRecord);
 		}
+		else
+		{
+			memcpy(slot, tailRecord, sizeof(Record));
+			rv = stepBack(&tail, &tailRecord);
+		}
+		written++;
+	}
 
-		BF_CALL_OR_EXIT(BF_UnpinBlock(block));
+	SR_ErrorCode releaseCode = releaseBackCursor(&output);
+	if (rv == SR_OK)
+		rv = releaseCode;
+	releaseCode = releaseBackCursor(&prefix);
+	if (rv == SR_OK)
+		rv = releaseCode;
+	releaseCode = releaseBackCursor(&tail);
+	if (rv == SR_OK)
+		rv = releaseCode;
+	releaseCode = SR_CloseFile(sortedfd);
+	if (rv == SR_OK)
+		rv = releaseCode;
+
+	if (rv == SR_OK)
+		countMerge(sortStats.phases, written * sizeof(Record), output.blocks, now() - start);
 
-		BF_Block_Destroy(&block);
+	return rv;
+}
+
+SR_ErrorCode SR_Resort(int fileDesc, int fieldNo, int bufferSize)
+{
+	if (fieldNo < 0 || fieldNo > 3 || bufferSize < 3 || bufferSize > BF_BUFFER_SIZE)
+		return SR_ERROR;
+
+	BF_Block *block;
+	BF_Block_Init(&block);
+	BF_CALL_OR_EXIT(getBlock(fileDesc, META, block));
+	char *meta = BF_Block_GetData(block);
+
+	bool sorted = (meta[IDENTIFIER] == SORTED);
+	int sortedOnField = meta[SORTED_ON] - 1;
+	int prefixOn = meta[PREFIX_ON] - 1;
+	long long prefixBlock;
+	int prefixSlot;
+	memcpy(&prefixBlock, &meta[PREFIX_BLOCK], sizeof(long long));
+	memcpy(&prefixSlot, &meta[PREFIX_SLOT], sizeof(int));
+
+	BF_CALL_OR_EXIT(unpinBlock(block));
+	BF_Block_Destroy(&block);
+
+	if (!sorted)
+		return SR_UNSORTED;
+	if (sortedOnField == fieldNo)
+		return SR_OK;
+
+	// Without a prefix sorted on fieldNo, the whole file is the tail
+	if (sortedOnField >= 0 || prefixOn != fieldNo || prefixBlock < 1)
+	{
+		prefixBlock = 1;
+		prefixSlot = 0;
 	}
 
-	printf("\nPrinted %d records in %d blocks.\n", records, blocks - 1);
+	char tailName[TEMP_PATH_SIZE], sortedName[TEMP_PATH_SIZE];
+	SR_CALL_OR_EXIT( makeTempFileName(tailName, sizeof(tailName)) );
+	SR_CALL_OR_EXIT( makeTempFileName(sortedName, sizeof(sortedName)) );
 
-	return SR_OK;
+	sortMode mode;
+	initSortMode(&mode, fieldNo);
+
+	long long records;
+	SR_ErrorCode rv = copyTail(fileDesc, prefixBlock, prefixSlot, tailName, &records);
+	if (rv == SR_OK && records > 0)
+	{
+		int tailfd;
+		rv = SR_OpenFile(tailName, &tailfd);
+		if (rv == SR_OK)
+		{
+			rv = sortFile(tailfd, sortedName, &mode, bufferSize, NULL, NULL);
+
+			SR_ErrorCode closeCode = SR_CloseFile(tailfd);
+			if (rv == SR_OK)
+				rv = closeCode;
+		}
+		removeFile(tailName);
+
+		// Up to here the file is as it was. It is marked sorted on no field
+		// before it is rewritten, so that a merge that fails half way
+		// leaves it with neither its old order nor a sorted prefix
+		if (rv == SR_OK)
+			rv = setSortedOn(fileDesc, -1);
+		if (rv == SR_OK)
+			rv = mergeTail(fileDesc, prefixBlock, prefixSlot, sortedName, &mode);
+		removeFile(sortedName);
+	}
+	else
+		removeFile(tailName);
+
+	if (rv == SR_OK)
+		rv = setSortedOn(fileDesc, fieldNo);
+
+	return rv;
 }
@@ -0,0 +1,190 @@
+#ifndef SORT_FILE_INTERNAL_H
+#define SORT_FILE_INTERNAL_H
+
+// What the translation units of the sort_file layer share with each other
+// None of it is part of the API of sort_file.h
+
+#include "sort_file.h"
+#include "bf.h"
+#include <pthread.h>
+#include <stddef.h>
+
+#define BF_CALL_OR_EXIT(call)	\
+{                           	\
+	BF_ErrorCode code = call; 	\
+	if(code != BF_OK) {       	\
+		BF_PrintError(code);    \
+		return SR_BF_ERROR;		\
+	}                         	\
+}
+
+// Like BF_CALL_OR_EXIT, for functions that return the BF code itself
+#define BF_CALL_OR_RETURN(call)	\
+{								\
+	BF_ErrorCode code = call;	\
+	if (code != BF_OK)			\
+		return code;			\
+}
+
+#define SR_CALL_OR_EXIT(call)	\
+{								\
+	SR_ErrorCode code  = call;	\
+	if( code != SR_OK)			\
+	{							\
+		return code; 			\
+	}							\
+}								\
+
+// sort_file.c: segmented files, the BF calls and the external sort
+
+// Longest path of a temp file
+#define TEMP_PATH_SIZE	(4096)
+
+// Frames shared by the sorts of SR_RunSortJobs
+// A sort takes its frames from the pool before every Phase Zero chunk and
+// every merge, and gives them back right after, so the frames of a job that
+// finishes go to the others from their next chunk or merge on
+typedef struct framePool {
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+	int total;		// Frames shared by all the jobs
+	int free;		// Frames no chunk or merge holds right now
+	int active;		// Jobs still running, each entitled to total / active frames
+} framePool;
+
+// Describes how an external sort orders its records
+// and what it does with records sharing the same key
+typedef struct sortMode {
+	int fieldNo;			// Field the records are ordered by
+	bool wholeRecord;		// Break ties on fieldNo by comparing the rest of the record
+
+	// Optional, called on every input record before it is written to a Phase Zero run
+	void (*prepare)(Record *record, const struct sortMode *mode);
+
+	// If set, records with the same key are folded into the first of them
+	// Folded records are never written, neither to runs nor to the output
+	bool fold;
+	// Optional, called with the record kept and each record folded into it
+	void (*absorb)(Record *last, const Record *next, const struct sortMode *mode);
+
+	SR_Aggregate aggregate;	// Used by the absorb of SR_SortedAggregate
+
+	// If positive, no run (nor the output) ever gets more than "limit" records
+	int limit;
+	// Records greater than the cutoff cannot make it to the output and are never written
+	// Set by Phase Zero when "limit" is, from the last record of its fullest runs
+	Record cutoff;
+	bool hasCutoff;
+
+	// If set, the frames of every chunk and merge are drawn from this pool
+	// instead of being the bufferSize the sort was given
+	framePool *pool;
+
+	// If set, the runs of the temp file are written compressed, see encodeRecord
+	bool compressRuns;
+} sortMode;
+
+void removeFile(const char *fileName);
+BF_ErrorCode createBlockFile(const char *fileName);
+BF_ErrorCode openBlockFile(const char *fileName, int *fileDesc);
+BF_ErrorCode closeBlockFile(const int fileDesc);
+BF_ErrorCode getBlockCounter(const int fileDesc, long long *blocks);
+BF_ErrorCode getBlock(const int fileDesc, const long long blockNum, BF_Block *block);
+BF_ErrorCode allocateBlock(const int fileDesc, BF_Block *block);
+BF_ErrorCode unpinBlock(BF_Block *block);
+void setDirty(BF_Block *block);
+BF_ErrorCode pinSharedBlock(const int fileDesc, const long long blockNum, BF_Block **block,
+                            BF_Block *other, const long long otherNum);
+BF_ErrorCode unpinSharedBlock(BF_Block **block, const bool dirty, BF_Block *other);
+
+bool isSorted(const int fileDesc);
+int sortedOn(const int fileDesc);
+
+bool compareRecord(const Record * const ra, const Record * const rb, const int fieldNo);
+char * recordField(const Record *record, const int fieldNo);
+int fieldSize(const int fieldNo);
+
+SR_ErrorCode makeTempFileName(char *name, size_t size);
+void initSortMode(sortMode *mode, const int fieldNo);
+SR_ErrorCode sortFile(int inputfd, const char* output_filename, sortMode *mode, int bufferSize,
+                      SR_ErrorCode (*emit)(const Record *record, void *sink), void *sink);
+
+// io_engine.c: the buffers of bulk loads and exports, read and written
+// through the engine chosen by SR_SetIOEngine
+
+// Engine and queue depth of the following loads and exports, see SR_SetIOEngine
+extern SR_IOEngine ioEngine;
+extern int ioDepth;
+
+// One buffer of an I/O queue, read into or written out at a file offset
+typedef struct ioRequest {
+	char *data;			// Buffer of the request
+	size_t length;		// Bytes to read or write
+	size_t done;		// Bytes read or written so far
+	long long offset;	// File offset of data[0], -1 for the current file position
+	bool busy;			// Submitted and not completed yet
+} ioRequest;
+
+// Up to "depth" buffers of one file descriptor, read or written through the engine
+// With SR_IO_SYNC a request is carried out as it is submitted, so none is ever busy
+typedef struct ioQueue {
+	SR_IOEngine engine;	// SR_IO_SYNC if io_uring could not be set up
+	int fd;
+	bool write;
+	int depth;
+	char *buffers;		// depth buffers, one per request
+	ioRequest requests[SR_MAX_IO_DEPTH];
+	struct ioRing *ring;	// Set up when engine is SR_IO_URING
+} ioQueue;
+
+SR_ErrorCode openQueue(ioQueue *queue, int fd, bool write, int depth, size_t size);
+SR_ErrorCode submitRequest(ioQueue *queue, int i);
+SR_ErrorCode waitRequest(ioQueue *queue);
+SR_ErrorCode closeQueue(ioQueue *queue);
+
+// export_load.c: SR_ExportEntries and the bulk loader
+
+// Size of the buffers the export functions format into
+// before handing each to the I/O engine in a single write
+#define EXPORT_BUFFER_SIZE	(1 << 20)
+
+// Width of each column of the table format, including
+// the leading '|' that separates it from the previous one
+#define TABLE_ID_WIDTH		(11)
+#define TABLE_NAME_WIDTH	(15)
+#define TABLE_SURNAME_WIDTH	(20)
+#define TABLE_CITY_WIDTH	(20)
+
+#define TABLE_SEPARATOR	"+-----------+---------------+--------------------+--------------------+\n"
+#define TABLE_HEADER	"|ID         |NAME           |SURNAME             |CITY                |\n"
+
+// A record never needs more than this many bytes once formatted,
+// whatever the format (CSV may double every character when quoting)
+#define EXPORT_MAX_ROW	(2 * sizeof(Record) + sizeof(TABLE_SEPARATOR) + 32)
+
+typedef struct exportBuffer {
+	ioQueue queue;		// Buffers the output is written from
+	int current;		// Request whose buffer is being filled
+	long long offset;	// Where the next buffer goes, -1 to write at the file position
+	size_t used;	// Bytes currently held in data
+	char *data;		// EXPORT_BUFFER_SIZE bytes, the buffer of request current
+} exportBuffer;
+
+SR_ErrorCode openExport(exportBuffer *buffer, int outputFd);
+SR_ErrorCode closeExport(exportBuffer *buffer, bool flush);
+SR_ErrorCode reserveExport(exportBuffer *buffer, size_t length);
+int appendNumber(exportBuffer *buffer, long long val);
+void appendCSVField(exportBuffer *buffer, const char *field, size_t size);
+
+// Packs records into full blocks appended to a file
+typedef struct loadWriter {
+	int fileDesc;		// File the blocks are allocated in
+	BF_Block *block;	// Block currently being filled, NULL if none
+	char *data;			// Data of current block
+	int records;		// Records held in current block
+} loadWriter;
+
+SR_ErrorCode writeLoadedRecords(loadWriter *writer, const Record *records, int count);
+SR_ErrorCode closeLoadWriter(loadWriter *writer);
+
+#endif // SORT_FILE_INTERNAL_H
@@ -0,0 +1,114 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bf.h"
+#include "sort_file.h"
+
+// SR_EXPORT_CSV output loaded back with SR_BulkLoad, with values holding
+// newlines, quotes and commas, in a source large enough to be split in
+// several windows and parallel chunks
+// Usage: csv_test
+
+#define FILE_RAW "csv_test_source.raw"
+#define FILE_FROM_RAW "csv_test_from_raw.db"
+#define FILE_CSV "csv_test_export.csv"
+#define FILE_FROM_CSV "csv_test_from_csv.db"
+#define FILE_EXPORT "csv_test_export.raw"
+
+#define COUNT 600000
+
+#define CALL_OR_DIE(call)     \
+  {                           \
+    SR_ErrorCode code = call; \
+    if (code != SR_OK) {      \
+      printf("Error\n");      \
+      exit(code);             \
+    }                         \
+  }
+
+static const char *names[] = { "two\nlines", "plain", "\n", "a\r\nb" };
+static const char *surnames[] = { "say \"hi\"", "\"", "o'neil", "\"\"quoted\"\"" };
+static const char *cities[] = { "a,b", "athens", ",\n,", "" };
+
+static Record recordOf(int i) {
+  Record record;
+  memset(&record, 0, sizeof(Record));
+  record.id = i;
+  strcpy(record.name, names[i % 4]);
+  strcpy(record.surname, surnames[(i / 4) % 4]);
+  strcpy(record.city, cities[(i / 16) % 4]);
+  return record;
+}
+
+static int openOrDie(const char *fileName, int flags) {
+  int fd = open(fileName, flags, 0644);
+  if (fd < 0) {
+    perror(fileName);
+    exit(1);
+  }
+  return fd;
+}
+
+// Exports fileName in "format" to outputName
+static void exportFile(const char *fileName, const char *outputName, SR_ExportFormat format) {
+  int fd;
+  CALL_OR_DIE(SR_OpenFile(fileName, &fd));
+  int outputFd = openOrDie(outputName, O_CREAT | O_TRUNC | O_WRONLY);
+  CALL_OR_DIE(SR_ExportEntries(fd, outputFd, format));
+  close(outputFd);
+  CALL_OR_DIE(SR_CloseFile(fd));
+}
+
+int main() {
+  BF_Init(LRU);
+  CALL_OR_DIE(SR_Init());
+
+  int rawFd = openOrDie(FILE_RAW, O_CREAT | O_TRUNC | O_WRONLY);
+  for (int i = 0; i < COUNT; i++) {
+    Record record = recordOf(i);
+    if (write(rawFd, &record, sizeof(Record)) != sizeof(Record)) {
+      perror(FILE_RAW);
+      exit(1);
+    }
+  }
+  close(rawFd);
+
+  remove(FILE_FROM_RAW);
+  remove(FILE_FROM_CSV);
+  CALL_OR_DIE(SR_BulkLoad(FILE_FROM_RAW, FILE_RAW, SR_LOAD_RAW));
+  exportFile(FILE_FROM_RAW, FILE_CSV, SR_EXPORT_CSV);
+  CALL_OR_DIE(SR_BulkLoad(FILE_FROM_CSV, FILE_CSV, SR_LOAD_CSV));
+  exportFile(FILE_FROM_CSV, FILE_EXPORT, SR_EXPORT_RAW);
+
+  int failed = 0, records = 0;
+  int exportFd = openOrDie(FILE_EXPORT, O_RDONLY);
+  Record record;
+  while (read(exportFd, &record, sizeof(Record)) == sizeof(Record)) {
+    Record expected = recordOf(records);
+    if (!failed && memcmp(&record, &expected, sizeof(Record)) != 0) {
+      printf("Record %d came back as %d \"%s\" \"%s\" \"%s\"\n", records, record.id,
+             record.name, record.surname, record.city);
+      failed = 1;
+    }
+    records++;
+  }
+  close(exportFd);
+
+  if (records != COUNT) {
+    printf("%d records instead of %d\n", records, COUNT);
+    failed = 1;
+  }
+
+  BF_Close();
+  remove(FILE_RAW);
+  remove(FILE_FROM_RAW);
+  remove(FILE_CSV);
+  remove(FILE_FROM_CSV);
+  remove(FILE_EXPORT);
+
+  printf(failed ? "csv_test failed\n" : "csv_test passed\n");
+  return failed;
+}
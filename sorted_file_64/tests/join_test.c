@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bf.h"
+#include "sort_file.h"
+
+// SR_MergeJoin with groups of equal keys in B too large to keep in memory,
+// starting in the middle of a block, so that the join has to rescan them
+// while B's own cursor still has the block after the group pinned
+// Usage: join_test
+
+#define FILE_A "join_test_a.db"
+#define FILE_B "join_test_b.db"
+
+#define RECORDS_A 40
+#define RECORDS_B 20000
+#define KEYS 3
+
+#define CALL_OR_DIE(call)     \
+  {                           \
+    SR_ErrorCode code = call; \
+    if (code != SR_OK) {      \
+      printf("Error\n");      \
+      exit(code);             \
+    }                         \
+  }
+
+static long long pairs[KEYS];
+
+static void countPair(const Record *left, const Record *right, void *context) {
+  (void) context;
+  if (left->id != right->id) {
+    printf("Joined %d with %d\n", left->id, right->id);
+    exit(1);
+  }
+  pairs[left->id]++;
+}
+
+// Creates "fileName" with "count" records whose ids are i mod KEYS, sorted on the id
+static void createInput(const char *fileName, int count) {
+  const char *unsorted = "join_test_unsorted.db";
+  remove(unsorted);
+  remove(fileName);
+
+  int fd;
+  CALL_OR_DIE(SR_CreateFile(unsorted));
+  CALL_OR_DIE(SR_OpenFile(unsorted, &fd));
+  for (int i = 0; i < count; i++) {
+    Record record;
+    memset(&record, 0, sizeof(Record));
+    record.id = i % KEYS;
+    snprintf(record.name, sizeof(record.name), "name_%d", i);
+    CALL_OR_DIE(SR_InsertEntry(fd, record));
+  }
+  CALL_OR_DIE(SR_CloseFile(fd));
+
+  CALL_OR_DIE(SR_SortedFile(unsorted, fileName, 0, BF_BUFFER_SIZE));
+  remove(unsorted);
+}
+
+int main() {
+  BF_Init(LRU);
+  CALL_OR_DIE(SR_Init());
+
+  createInput(FILE_A, RECORDS_A);
+  createInput(FILE_B, RECORDS_B);
+
+  const int bufferSizes[] = { 3, 20 };
+  int failed = 0;
+  for (int b = 0; b < 2; b++) {
+    int fdA, fdB;
+    CALL_OR_DIE(SR_OpenFile(FILE_A, &fdA));
+    CALL_OR_DIE(SR_OpenFile(FILE_B, &fdB));
+
+    memset(pairs, 0, sizeof(pairs));
+    CALL_OR_DIE(SR_MergeJoin(fdA, fdB, 0, bufferSizes[b], countPair, NULL));
+
+    for (int key = 0; key < KEYS; key++) {
+      long long countA = (RECORDS_A - key + KEYS - 1) / KEYS;
+      long long countB = (RECORDS_B - key + KEYS - 1) / KEYS;
+      if (pairs[key] != countA * countB) {
+        printf("bufferSize %d, key %d: %lld pairs instead of %lld\n",
+               bufferSizes[b], key, pairs[key], countA * countB);
+        failed = 1;
+      }
+    }
+
+    CALL_OR_DIE(SR_CloseFile(fdA));
+    CALL_OR_DIE(SR_CloseFile(fdB));
+  }
+
+  BF_Close();
+  remove(FILE_A);
+  remove(FILE_B);
+
+  printf(failed ? "join_test failed\n" : "join_test passed\n");
+  return failed;
+}
@@ -0,0 +1,144 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bf.h"
+#include "sort_file.h"
+
+// SR_Resort of a sorted file with records appended to it, in segments of
+// one, three and the default number of blocks, so that the merge walks the
+// tail back across segment boundaries while the prefix is still being read
+// Usage: resort_test
+
+#define FILE_UNSORTED "resort_test_unsorted.db"
+#define FILE_SORTED "resort_test_sorted.db"
+#define FILE_EXPORT "resort_test_export.raw"
+
+#define PREFIX 6000
+
+#define CALL_OR_DIE(call)     \
+  {                           \
+    SR_ErrorCode code = call; \
+    if (code != SR_OK) {      \
+      printf("Error\n");      \
+      exit(code);             \
+    }                         \
+  }
+
+// Removes fileName along with every segment after it
+static void removeFile(const char *fileName) {
+  remove(fileName);
+  for (int i = 1;; i++) {
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s.%d", fileName, i);
+    if (remove(name) != 0)
+      break;
+  }
+}
+
+static void insertRecord(int fd, int id) {
+  Record record;
+  memset(&record, 0, sizeof(Record));
+  record.id = id;
+  // Ids stay below 10^9, so that the name fits
+  snprintf(record.name, sizeof(record.name), "name_%u", (unsigned) id % 1000000000u);
+  CALL_OR_DIE(SR_InsertEntry(fd, record));
+}
+
+// Creates FILE_SORTED with the even ids below 2 * PREFIX, sorted on the id
+static void createPrefix(void) {
+  removeFile(FILE_UNSORTED);
+  removeFile(FILE_SORTED);
+
+  int fd;
+  CALL_OR_DIE(SR_CreateFile(FILE_UNSORTED));
+  CALL_OR_DIE(SR_OpenFile(FILE_UNSORTED, &fd));
+  for (int i = 0; i < PREFIX; i++)
+    insertRecord(fd, 2 * (int) ((i * 7919LL) % PREFIX));
+  CALL_OR_DIE(SR_CloseFile(fd));
+
+  CALL_OR_DIE(SR_SortedFile(FILE_UNSORTED, FILE_SORTED, 0, BF_BUFFER_SIZE));
+  removeFile(FILE_UNSORTED);
+}
+
+// Checks through SR_ExportEntries that the open file fd holds the even ids
+// below 2 * PREFIX and the odd ones below 2 * tail, in order. Returns 0 if it does
+static int checkResorted(int fd, int tail) {
+  int outputFd = open(FILE_EXPORT, O_CREAT | O_TRUNC | O_RDWR, 0644);
+  if (outputFd < 0) {
+    perror(FILE_EXPORT);
+    exit(1);
+  }
+  CALL_OR_DIE(SR_ExportEntries(fd, outputFd, SR_EXPORT_RAW));
+
+  int failed = 0, records = 0, expected = 0;
+  Record record;
+  lseek(outputFd, 0, SEEK_SET);
+  while (read(outputFd, &record, sizeof(Record)) == sizeof(Record)) {
+    if (!failed && record.id != expected) {
+      printf("Record %d has id %d instead of %d\n", records, record.id, expected);
+      failed = 1;
+    }
+    records++;
+    expected += (expected < 2 * tail) ? 1 : 2;
+  }
+  close(outputFd);
+  remove(FILE_EXPORT);
+
+  if (records != PREFIX + tail) {
+    printf("%d records instead of %d\n", records, PREFIX + tail);
+    failed = 1;
+  }
+  return failed;
+}
+
+// Appends "tail" records to a sorted prefix in segments of segmentBlocks
+// blocks and resorts the file with bufferSize blocks
+static int testResort(int segmentBlocks, int tail, int bufferSize) {
+  CALL_OR_DIE(SR_SetSegmentBlocks(segmentBlocks));
+  createPrefix();
+
+  int fd;
+  CALL_OR_DIE(SR_OpenFile(FILE_SORTED, &fd));
+  for (int i = 0; i < tail; i++)
+    insertRecord(fd, 2 * (tail - 1 - i) + 1);
+
+  int failed = 0;
+  SR_ErrorCode code = SR_Resort(fd, 0, bufferSize);
+  if (code != SR_OK) {
+    printf("SR_Resort returned %d\n", code);
+    failed = 1;
+  } else
+    failed = checkResorted(fd, tail);
+  CALL_OR_DIE(SR_CloseFile(fd));
+
+  if (failed)
+    printf("segmentBlocks %d, tail %d, bufferSize %d failed\n", segmentBlocks, tail, bufferSize);
+
+  removeFile(FILE_SORTED);
+  CALL_OR_DIE(SR_SetSegmentBlocks(0));
+  return failed;
+}
+
+int main() {
+  BF_Init(LRU);
+  CALL_OR_DIE(SR_Init());
+
+  const int segmentBlocks[] = { 1, 3, 0 };
+  const int tails[] = { 1, 40, 1000 };
+  int failed = 0;
+  for (int s = 0; s < 3; s++) {
+    for (int t = 0; t < 3; t++) {
+      failed |= testResort(segmentBlocks[s], tails[t], 3);
+      failed |= testResort(segmentBlocks[s], tails[t], BF_BUFFER_SIZE);
+    }
+  }
+
+  BF_Close();
+
+  printf(failed ? "resort_test failed\n" : "resort_test passed\n");
+  return failed;
+}
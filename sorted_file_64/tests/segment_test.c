@@ -0,0 +1,188 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bf.h"
+#include "sort_file.h"
+
+// Files split into segments (see SR_SetSegmentBlocks): sorting and scanning
+// files of one and three blocks per segment, the first spanning more segments
+// than BF_MAX_OPEN_FILES, and appending past block INT_MAX of a sparse file
+// Usage: segment_test
+
+#define FILE_UNSORTED "segment_test_unsorted.db"
+#define FILE_SORTED "segment_test_sorted.db"
+#define FILE_EXPORT "segment_test_export.raw"
+#define FILE_SPARSE "segment_test_sparse.db"
+
+#define COUNT 3000
+
+#define CALL_OR_DIE(call)     \
+  {                           \
+    SR_ErrorCode code = call; \
+    if (code != SR_OK) {      \
+      printf("Error\n");      \
+      exit(code);             \
+    }                         \
+  }
+
+// Removes fileName along with every segment after it
+static void removeFile(const char *fileName) {
+  remove(fileName);
+  for (int i = 1;; i++) {
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s.%d", fileName, i);
+    if (remove(name) != 0)
+      break;
+  }
+}
+
+// Creates fileName with "count" records in a scrambled order of their ids
+static void createInput(const char *fileName, int count) {
+  removeFile(fileName);
+
+  int fd;
+  CALL_OR_DIE(SR_CreateFile(fileName));
+  CALL_OR_DIE(SR_OpenFile(fileName, &fd));
+  for (int i = 0; i < count; i++) {
+    Record record;
+    memset(&record, 0, sizeof(Record));
+    record.id = (int) ((i * 7919LL) % count);
+    snprintf(record.name, sizeof(record.name), "name_%d", record.id);
+    CALL_OR_DIE(SR_InsertEntry(fd, record));
+  }
+  CALL_OR_DIE(SR_CloseFile(fd));
+}
+
+// Scans fileName through SR_ExportEntries and checks that it holds the ids
+// 0 to count - 1 in order. Returns 0 if it does
+static int checkSorted(const char *fileName, int count) {
+  int fd;
+  CALL_OR_DIE(SR_OpenFile(fileName, &fd));
+  int outputFd = open(FILE_EXPORT, O_CREAT | O_TRUNC | O_RDWR, 0644);
+  if (outputFd < 0) {
+    perror(FILE_EXPORT);
+    exit(1);
+  }
+  CALL_OR_DIE(SR_ExportEntries(fd, outputFd, SR_EXPORT_RAW));
+  CALL_OR_DIE(SR_CloseFile(fd));
+
+  int failed = 0, records = 0;
+  Record record;
+  lseek(outputFd, 0, SEEK_SET);
+  while (read(outputFd, &record, sizeof(Record)) == sizeof(Record)) {
+    if (!failed && record.id != records) {
+      printf("%s: record %d has id %d\n", fileName, records, record.id);
+      failed = 1;
+    }
+    records++;
+  }
+  close(outputFd);
+  remove(FILE_EXPORT);
+
+  if (records != count) {
+    printf("%s: %d records instead of %d\n", fileName, records, count);
+    failed = 1;
+  }
+  return failed;
+}
+
+// Sorts COUNT records in segments of segmentBlocks blocks with every buffer size given
+static int testSegments(int segmentBlocks) {
+  CALL_OR_DIE(SR_SetSegmentBlocks(segmentBlocks));
+  createInput(FILE_UNSORTED, COUNT);
+
+  const int bufferSizes[] = { 3, 20, BF_BUFFER_SIZE };
+  int failed = 0;
+  for (int b = 0; b < 3; b++) {
+    removeFile(FILE_SORTED);
+    CALL_OR_DIE(SR_SortedFile(FILE_UNSORTED, FILE_SORTED, 0, bufferSizes[b]));
+    if (checkSorted(FILE_SORTED, COUNT)) {
+      printf("segmentBlocks %d, bufferSize %d failed\n", segmentBlocks, bufferSizes[b]);
+      failed = 1;
+    }
+  }
+
+  removeFile(FILE_UNSORTED);
+  removeFile(FILE_SORTED);
+  CALL_OR_DIE(SR_SetSegmentBlocks(0));
+  return failed;
+}
+
+// Reads the record count of block "block" of the segment file fileName
+static int recordsOf(const char *fileName, int block) {
+  int count = -1;
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0 || pread(fd, &count, sizeof(int), (off_t) block * BF_BLOCK_SIZE + RECORDS) != sizeof(int))
+    count = -1;
+  if (fd >= 0)
+    close(fd);
+  return count;
+}
+
+// Fills a file up to block INT_MAX with holes, in segments of the default
+// size, and appends past it. The holes take no room on disk, and of the
+// segments past the first only the last one is ever opened
+static int testSparse(void) {
+  const long long segmentBlocks = SR_MAX_SEGMENT_BLOCKS;
+  const int last = (int) (INT_MAX / segmentBlocks);
+  const int lastBlocks = (int) (INT_MAX - last * segmentBlocks + 1);
+
+  removeFile(FILE_SPARSE);
+  CALL_OR_DIE(SR_CreateFile(FILE_SPARSE));
+  for (int i = 0; i <= last; i++) {
+    char name[PATH_MAX];
+    if (i == 0)
+      snprintf(name, sizeof(name), "%s", FILE_SPARSE);
+    else
+      snprintf(name, sizeof(name), "%s.%d", FILE_SPARSE, i);
+    int fd = open(name, O_CREAT | O_WRONLY, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t) ((i < last) ? segmentBlocks : lastBlocks) * BF_BLOCK_SIZE) != 0) {
+      perror(name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  // Block INT_MAX is empty, so the first MAXRECORDS records fill it and the
+  // rest go to block INT_MAX + 1, which is appended to the last segment
+  const int count = (int) MAXRECORDS + 2;
+  for (int i = 0; i < count; i++) {
+    int fd;
+    CALL_OR_DIE(SR_OpenFile(FILE_SPARSE, &fd));
+    Record record;
+    memset(&record, 0, sizeof(Record));
+    record.id = i;
+    CALL_OR_DIE(SR_InsertEntry(fd, record));
+    CALL_OR_DIE(SR_CloseFile(fd));
+  }
+
+  char name[PATH_MAX];
+  snprintf(name, sizeof(name), "%s.%d", FILE_SPARSE, last);
+  int failed = 0;
+  if (recordsOf(name, lastBlocks - 1) != (int) MAXRECORDS || recordsOf(name, lastBlocks) != count - (int) MAXRECORDS) {
+    printf("Block %d holds %d records and block %lld %d\n", INT_MAX, recordsOf(name, lastBlocks - 1),
+           (long long) INT_MAX + 1, recordsOf(name, lastBlocks));
+    failed = 1;
+  }
+
+  removeFile(FILE_SPARSE);
+  return failed;
+}
+
+int main() {
+  BF_Init(LRU);
+  CALL_OR_DIE(SR_Init());
+
+  int failed = testSegments(1);
+  failed |= testSegments(3);
+  failed |= testSparse();
+
+  BF_Close();
+
+  printf(failed ? "segment_test failed\n" : "segment_test passed\n");
+  return failed;
+}
@@ -0,0 +1,30 @@
+# Test programs. Run from the project root with
+#   make -f tests/test.mk test
+# or add "include tests/test.mk" to the Makefile.
+# Each program prints "<name> passed" and exits with 0, or says what failed.
+
+TESTS = csv_test join_test segment_test resort_test
+
+csv_test:
+	@echo " Compile csv_test ...";
+	gcc -I ./include/ -L ./lib/ -Wl,-rpath,./lib/ ./tests/csv_test.c ./src/*.c -lbf -o ./build/csv_test -O2
+
+join_test:
+	@echo " Compile join_test ...";
+	gcc -I ./include/ -L ./lib/ -Wl,-rpath,./lib/ ./tests/join_test.c ./src/*.c -lbf -o ./build/join_test -O2
+
+segment_test:
+	@echo " Compile segment_test ...";
+	gcc -I ./include/ -L ./lib/ -Wl,-rpath,./lib/ ./tests/segment_test.c ./src/*.c -lbf -o ./build/segment_test -O2
+
+resort_test:
+	@echo " Compile resort_test ...";
+	gcc -I ./include/ -L ./lib/ -Wl,-rpath,./lib/ ./tests/resort_test.c ./src/*.c -lbf -o ./build/resort_test -O2
+
+test: $(TESTS)
+	@for t in $(TESTS); do \
+		echo " Run $$t ..."; \
+		./build/$$t || exit 1; \
+	done
+
+.PHONY: $(TESTS) test